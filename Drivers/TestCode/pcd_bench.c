@@ -0,0 +1,364 @@
+/*
+ * pcd-bench: throughput and latency benchmark for pcd devices
+ *
+ * build: gcc -O2 -Wall -pthread -o pcd_bench pcd_bench.c
+ * usage: pcd_bench [options] /dev/pcdev-N
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#define MAX_THREADS 256
+
+/* Latency histogram: 16 linear sub-buckets per power of two, ~6% resolution */
+#define SUB_BITS 4
+#define SUB_BUCKETS (1 << SUB_BITS)
+#define HIST_BUCKETS (64 * SUB_BUCKETS)
+
+struct bench_config {
+	const char *path;
+	int threads;
+	size_t block_size;
+	int read_pct;		/* share of reads in percent, the rest are writes */
+	int random;		/* random offsets instead of sequential */
+	double duration;	/* seconds */
+	const char *csv_path;
+	const char *label;	/* tag for the CSV row, e.g. the driver build */
+	off_t dev_size;
+	int stream;		/* device has no offsets (fifo mode) */
+};
+
+struct thread_stats {
+	uint64_t reads;
+	uint64_t writes;
+	uint64_t read_bytes;
+	uint64_t write_bytes;
+	uint64_t errors;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+struct thread_ctx {
+	pthread_t tid;
+	int id;
+	int fd;
+	struct bench_config *cfg;
+	struct thread_stats stats;
+};
+
+static volatile int stop;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static unsigned int hist_bucket(uint64_t ns)
+{
+	unsigned int msb;
+
+	if (ns < SUB_BUCKETS)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+}
+
+/* Lower bound of a bucket, reported percentiles are within one bucket */
+static uint64_t hist_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < SUB_BUCKETS)
+		return bucket;
+	shift = bucket / SUB_BUCKETS - 1;
+	return ((uint64_t)SUB_BUCKETS + bucket % SUB_BUCKETS) << shift;
+}
+
+static uint64_t hist_percentile(const uint64_t *hist, uint64_t total, double pct)
+{
+	uint64_t target = (uint64_t)(total * pct / 100.0);
+	uint64_t seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (seen > target)
+			return hist_value(i);
+	}
+	return 0;
+}
+
+/* xorshift64, one state per thread so threads do not contend */
+static uint64_t next_rand(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static void *bench_thread(void *arg)
+{
+	struct thread_ctx *ctx = arg;
+	struct bench_config *cfg = ctx->cfg;
+	uint64_t rnd = 0x9e3779b97f4a7c15ull * (ctx->id + 1);
+	off_t blocks = cfg->dev_size / cfg->block_size;
+	off_t offset = (blocks / cfg->threads) * ctx->id * cfg->block_size;
+	uint64_t start, lat;
+	ssize_t ret;
+	char *buf;
+	int is_read;
+
+	buf = malloc(cfg->block_size);
+	if (!buf)
+		return NULL;
+	memset(buf, 'a' + ctx->id % 26, cfg->block_size);
+
+	while (!stop) {
+		is_read = (int)(next_rand(&rnd) % 100) < cfg->read_pct;
+
+		if (!cfg->stream) {
+			if (cfg->random)
+				offset = (next_rand(&rnd) % blocks) * cfg->block_size;
+			else if (offset + (off_t)cfg->block_size > cfg->dev_size)
+				offset = 0;
+		}
+
+		start = now_ns();
+		if (cfg->stream)
+			ret = is_read ? read(ctx->fd, buf, cfg->block_size) : write(ctx->fd, buf, cfg->block_size);
+		else if (is_read)
+			ret = pread(ctx->fd, buf, cfg->block_size, offset);
+		else
+			ret = pwrite(ctx->fd, buf, cfg->block_size, offset);
+		lat = now_ns() - start;
+
+		if (ret < 0) {
+			/* fifo devices opened O_NONBLOCK may just be empty or full */
+			if (errno != EAGAIN)
+				ctx->stats.errors++;
+			continue;
+		}
+
+		ctx->stats.hist[hist_bucket(lat)]++;
+		if (is_read) {
+			ctx->stats.reads++;
+			ctx->stats.read_bytes += ret;
+		} else {
+			ctx->stats.writes++;
+			ctx->stats.write_bytes += ret;
+		}
+		offset += cfg->block_size;
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] <device>\n"
+	       "  -t <threads>     worker threads (default 1)\n"
+	       "  -b <bytes>       block size (default 4096)\n"
+	       "  -r <percent>     reads in percent of all ops, rest are writes (default 100)\n"
+	       "  -m <seq|rand>    offset pattern (default seq)\n"
+	       "  -d <seconds>     run time (default 5)\n"
+	       "  -c <file>        append results as a CSV row, header is written to new files\n"
+	       "  -l <label>       label of the CSV row (default none)\n", prog);
+}
+
+static int parse_args(int argc, char *argv[], struct bench_config *cfg)
+{
+	int opt;
+
+	cfg->threads = 1;
+	cfg->block_size = 4096;
+	cfg->read_pct = 100;
+	cfg->random = 0;
+	cfg->duration = 5;
+	cfg->csv_path = NULL;
+	cfg->label = "";
+
+	while ((opt = getopt(argc, argv, "t:b:r:m:d:c:l:h")) != -1) {
+		switch (opt) {
+		case 't':
+			cfg->threads = atoi(optarg);
+			break;
+		case 'b':
+			cfg->block_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			cfg->read_pct = atoi(optarg);
+			break;
+		case 'm':
+			cfg->random = !strcmp(optarg, "rand");
+			break;
+		case 'd':
+			cfg->duration = atof(optarg);
+			break;
+		case 'c':
+			cfg->csv_path = optarg;
+			break;
+		case 'l':
+			cfg->label = optarg;
+			break;
+		default:
+			return -1;
+		}
+	}
+
+	if (optind != argc - 1)
+		return -1;
+	cfg->path = argv[optind];
+
+	if (cfg->threads < 1 || cfg->threads > MAX_THREADS || !cfg->block_size ||
+	    cfg->read_pct < 0 || cfg->read_pct > 100 || cfg->duration <= 0) {
+		fprintf(stderr, "invalid arguments\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void report(struct bench_config *cfg, struct thread_stats *total, double secs)
+{
+	uint64_t ops = total->reads + total->writes;
+	double mbs = (total->read_bytes + total->write_bytes) / secs / (1024 * 1024);
+	uint64_t p50 = hist_percentile(total->hist, ops, 50);
+	uint64_t p99 = hist_percentile(total->hist, ops, 99);
+	uint64_t p999 = hist_percentile(total->hist, ops, 99.9);
+	FILE *csv;
+	int header;
+
+	if (cfg->stream)
+		printf("device     : %s (stream)\n", cfg->path);
+	else
+		printf("device     : %s (%lld bytes)\n", cfg->path, (long long)cfg->dev_size);
+	printf("workload   : %d threads, %zu byte blocks, %d%% reads, %s\n",
+	       cfg->threads, cfg->block_size, cfg->read_pct, cfg->random ? "random" : "sequential");
+	printf("duration   : %.2f s\n", secs);
+	printf("ops        : %llu (%llu reads, %llu writes, %llu errors)\n",
+	       (unsigned long long)ops, (unsigned long long)total->reads,
+	       (unsigned long long)total->writes, (unsigned long long)total->errors);
+	printf("throughput : %.0f ops/s, %.2f MB/s\n", ops / secs, mbs);
+	printf("latency    : p50 %llu ns, p99 %llu ns, p999 %llu ns\n",
+	       (unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999);
+
+	if (!cfg->csv_path)
+		return;
+
+	header = access(cfg->csv_path, F_OK) != 0;
+	csv = fopen(cfg->csv_path, "a");
+	if (!csv) {
+		perror("fopen");
+		return;
+	}
+	if (header)
+		fprintf(csv, "label,device,threads,block_size,read_pct,pattern,duration_s,ops,errors,ops_per_s,mb_per_s,p50_ns,p99_ns,p999_ns\n");
+	fprintf(csv, "%s,%s,%d,%zu,%d,%s,%.2f,%llu,%llu,%.0f,%.2f,%llu,%llu,%llu\n",
+		cfg->label, cfg->path, cfg->threads, cfg->block_size, cfg->read_pct,
+		cfg->random ? "rand" : "seq", secs, (unsigned long long)ops,
+		(unsigned long long)total->errors, ops / secs, mbs,
+		(unsigned long long)p50, (unsigned long long)p99, (unsigned long long)p999);
+	fclose(csv);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_config cfg;
+	struct thread_ctx *ctx;
+	struct thread_stats total;
+	struct timespec sleep_ts;
+	uint64_t start;
+	double secs;
+	int flags, fd, i, j;
+
+	if (parse_args(argc, argv, &cfg)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	flags = cfg.read_pct == 100 ? O_RDONLY : cfg.read_pct == 0 ? O_WRONLY : O_RDWR;
+	fd = open(cfg.path, flags);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+
+	/* pcd_lseek reports the device size for SEEK_END, fifo devices refuse to seek */
+	cfg.dev_size = lseek(fd, 0, SEEK_END);
+	cfg.stream = cfg.dev_size < 0 && errno == ESPIPE;
+	if (cfg.dev_size < 0 && !cfg.stream) {
+		perror("lseek");
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	if (!cfg.stream && cfg.dev_size < (off_t)cfg.block_size) {
+		fprintf(stderr, "block size %zu exceeds device size %lld\n", cfg.block_size, (long long)cfg.dev_size);
+		return 1;
+	}
+
+	ctx = calloc(cfg.threads, sizeof(*ctx));
+	if (!ctx) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* One descriptor per thread so file position and f_lock are never shared */
+	for (i = 0; i < cfg.threads; i++) {
+		ctx[i].fd = open(cfg.path, flags | (cfg.stream ? O_NONBLOCK : 0));
+		if (ctx[i].fd < 0) {
+			perror("open");
+			return 1;
+		}
+		ctx[i].id = i;
+		ctx[i].cfg = &cfg;
+	}
+
+	start = now_ns();
+	for (i = 0; i < cfg.threads; i++) {
+		if (pthread_create(&ctx[i].tid, NULL, bench_thread, &ctx[i])) {
+			perror("pthread_create");
+			stop = 1;
+			cfg.threads = i;
+			break;
+		}
+	}
+
+	sleep_ts.tv_sec = (time_t)cfg.duration;
+	sleep_ts.tv_nsec = (long)((cfg.duration - sleep_ts.tv_sec) * 1e9);
+	nanosleep(&sleep_ts, NULL);
+	stop = 1;
+
+	memset(&total, 0, sizeof(total));
+	for (i = 0; i < cfg.threads; i++) {
+		pthread_join(ctx[i].tid, NULL);
+		close(ctx[i].fd);
+		total.reads += ctx[i].stats.reads;
+		total.writes += ctx[i].stats.writes;
+		total.read_bytes += ctx[i].stats.read_bytes;
+		total.write_bytes += ctx[i].stats.write_bytes;
+		total.errors += ctx[i].stats.errors;
+		for (j = 0; j < HIST_BUCKETS; j++)
+			total.hist[j] += ctx[i].stats.hist[j];
+	}
+	secs = (now_ns() - start) / 1e9;
+
+	report(&cfg, &total, secs);
+
+	free(ctx);
+	return 0;
+}
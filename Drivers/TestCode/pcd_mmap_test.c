@@ -0,0 +1,178 @@
+/*
+ * pcd-mmap-test: stores through a MAP_SHARED mapping of a pcd device
+ *
+ * build: gcc -O2 -Wall -o pcd_mmap_test pcd_mmap_test.c
+ * usage: pcd_mmap_test [-p <pages>] [-t <seconds>] /dev/pcdev-N
+ *
+ * The device has to be a read/write random access device. Every page is
+ * written through the mapping twice: once while it is still a hole or shared,
+ * which copies it in page_mkwrite, and once after pwrite() made it private.
+ * Both must reach the device and writes to the device must show up in the
+ * mapping. A store that never completes is reported as a hang.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *phase = "setup";
+
+static void on_alarm(int sig)
+{
+	/* Only async-signal-safe calls in here */
+	static const char msg[] = "FAIL: timed out, a store through the mapping never completed\n";
+
+	(void)sig;
+	write(STDERR_FILENO, msg, sizeof(msg) - 1);
+	_exit(1);
+}
+
+static void usage(const char *prog)
+{
+	printf("usage: %s [options] <device>\n"
+	       "  -p <pages>       pages to map, capped at the device size (default 4)\n"
+	       "  -t <seconds>     fail if the test takes longer (default 10)\n", prog);
+}
+
+/* Compare len bytes of the device at offset with buf */
+static int check_device(int fd, const char *buf, size_t len, off_t offset)
+{
+	char *tmp = malloc(len);
+	ssize_t ret;
+	int bad;
+
+	if (!tmp) {
+		perror("malloc");
+		return -1;
+	}
+	ret = pread(fd, tmp, len, offset);
+	if (ret != (ssize_t)len) {
+		fprintf(stderr, "FAIL: %s: pread at %lld returned %zd\n", phase, (long long)offset, ret);
+		free(tmp);
+		return -1;
+	}
+	bad = memcmp(tmp, buf, len);
+	free(tmp);
+	if (bad) {
+		fprintf(stderr, "FAIL: %s: device contents at %lld differ from the mapping\n",
+			phase, (long long)offset);
+		return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+	unsigned int timeout = 10;
+	size_t pages = 4, len, i;
+	off_t dev_size;
+	char *map, *buf;
+	int fd, opt;
+
+	while ((opt = getopt(argc, argv, "p:t:h")) != -1) {
+		switch (opt) {
+		case 'p':
+			pages = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			timeout = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	if (optind != argc - 1 || !pages || !timeout) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	fd = open(argv[optind], O_RDWR);
+	if (fd < 0) {
+		perror("open");
+		return 1;
+	}
+
+	dev_size = lseek(fd, 0, SEEK_END);
+	if (dev_size <= 0) {
+		perror("lseek");
+		return 1;
+	}
+
+	/* Whole pages only, the tail of a partial last page is not part of the device */
+	if ((off_t)(pages * page_size) > dev_size)
+		pages = dev_size / page_size;
+	if (!pages) {
+		fprintf(stderr, "device of %lld bytes has no whole page\n", (long long)dev_size);
+		return 1;
+	}
+	len = pages * page_size;
+
+	buf = malloc(len);
+	if (!buf) {
+		perror("malloc");
+		return 1;
+	}
+
+	signal(SIGALRM, on_alarm);
+	alarm(timeout);
+
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		/* Integrity checked devices only map read-only */
+		perror("mmap");
+		return 1;
+	}
+
+	/* Holes are shared with the zero page, the first store copies them */
+	phase = "store to holes";
+	for (i = 0; i < len; i++)
+		map[i] = buf[i] = 'a' + i % 26;
+	if (check_device(fd, buf, len, 0))
+		return 1;
+
+	/* pwrite() leaves private pages behind, stores go straight to them */
+	phase = "store to private pages";
+	munmap(map, len);
+	memset(buf, 'x', len);
+	if (pwrite(fd, buf, len, 0) != (ssize_t)len) {
+		perror("pwrite");
+		return 1;
+	}
+	map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("mmap");
+		return 1;
+	}
+	for (i = 0; i < len; i++)
+		map[i] = buf[i] = 'A' + i % 26;
+	if (check_device(fd, buf, len, 0))
+		return 1;
+
+	/* And the other way round, the mapping sees writes to the device */
+	phase = "pwrite seen by the mapping";
+	memset(buf, 'z', page_size);
+	if (pwrite(fd, buf, page_size, 0) != page_size) {
+		perror("pwrite");
+		return 1;
+	}
+	if (memcmp(map, buf, page_size)) {
+		fprintf(stderr, "FAIL: %s: mapping does not show the written data\n", phase);
+		return 1;
+	}
+
+	alarm(0);
+	munmap(map, len);
+	close(fd);
+	free(buf);
+
+	printf("PASS: %zu pages written through the mapping of %s\n", pages, argv[optind]);
+	return 0;
+}
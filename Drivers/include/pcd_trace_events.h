@@ -0,0 +1,159 @@
+/*Event classes shared by the trace headers of all pcd modules. Every module
+defines its events from these under a TRACE_SYSTEM of its own, so modules can
+be loaded side by side and tools see the same layout in each of them. Included
+from inside the module's trace header, once per pass of define_trace.h*/
+#if !defined(PCD_TRACE_EVENTS_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PCD_TRACE_EVENTS_H
+
+#include <linux/tracepoint.h>
+
+//Common layout of the read and write events, latency is 0 when it was not measured
+DECLARE_EVENT_CLASS(pcd_io_class,
+
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+
+    TP_ARGS(dev, pos, count, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+        __field(loff_t, pos)
+        __field(size_t, count)
+        __field(ssize_t, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->pos = pos;
+        __entry->count = count;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("dev=%d:%d pos=%lld count=%zu ret=%zd latency_ns=%llu",
+        MAJOR(__entry->dev), MINOR(__entry->dev), __entry->pos,
+        __entry->count, __entry->ret, __entry->latency_ns)
+);
+
+DECLARE_EVENT_CLASS(pcd_lseek_class,
+
+    TP_PROTO(dev_t dev, loff_t old_pos, loff_t offset, int whence, loff_t ret),
+
+    TP_ARGS(dev, old_pos, offset, whence, ret),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+        __field(loff_t, old_pos)
+        __field(loff_t, offset)
+        __field(int, whence)
+        __field(loff_t, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->old_pos = old_pos;
+        __entry->offset = offset;
+        __entry->whence = whence;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("dev=%d:%d old_pos=%lld offset=%lld whence=%s ret=%lld",
+        MAJOR(__entry->dev), MINOR(__entry->dev), __entry->old_pos, __entry->offset,
+        __print_symbolic(__entry->whence,
+            { SEEK_SET, "SEEK_SET" },
+            { SEEK_CUR, "SEEK_CUR" },
+            { SEEK_END, "SEEK_END" },
+            { SEEK_DATA, "SEEK_DATA" },
+            { SEEK_HOLE, "SEEK_HOLE" }),
+        __entry->ret)
+);
+
+DECLARE_EVENT_CLASS(pcd_open_class,
+
+    TP_PROTO(dev_t dev, fmode_t mode, int ret),
+
+    TP_ARGS(dev, mode, ret),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+        __field(fmode_t, mode)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->mode = mode;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("dev=%d:%d read=%d write=%d ret=%d",
+        MAJOR(__entry->dev), MINOR(__entry->dev), !!(__entry->mode & FMODE_READ),
+        !!(__entry->mode & FMODE_WRITE), __entry->ret)
+);
+
+DECLARE_EVENT_CLASS(pcd_release_class,
+
+    TP_PROTO(dev_t dev),
+
+    TP_ARGS(dev),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+    ),
+
+    TP_printk("dev=%d:%d", MAJOR(__entry->dev), MINOR(__entry->dev))
+);
+
+//Platform device probes, size and perm are 0 when probe failed
+DECLARE_EVENT_CLASS(pcd_probe_class,
+
+    TP_PROTO(const char *name, int size, int perm, int ret, u64 latency_ns),
+
+    TP_ARGS(name, size, perm, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(int, size)
+        __field(int, perm)
+        __field(int, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->size = size;
+        __entry->perm = perm;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("name=%s size=%d perm=0x%x ret=%d latency_ns=%llu",
+        __get_str(name), __entry->size, __entry->perm, __entry->ret,
+        __entry->latency_ns)
+);
+
+DECLARE_EVENT_CLASS(pcd_remove_class,
+
+    TP_PROTO(dev_t dev, const char *serial),
+
+    TP_ARGS(dev, serial),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+        __string(serial, serial)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __assign_str(serial, serial);
+    ),
+
+    TP_printk("dev=%d:%d serial=%s",
+        MAJOR(__entry->dev), MINOR(__entry->dev), __get_str(serial))
+);
+
+#endif
@@ -4,9 +4,19 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
+#include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include "pcd_m_trace.h"
 
 #define NO_OF_DEVICES 4
 
+//Upper bound of nr_devices, minors are reserved for all of them at load
+#define MAX_DEVICES 4096
+
 #define PCD1_MEM_SIZE 1024
 #define PCD2_MEM_SIZE 512
 #define PCD3_MEM_SIZE 1024
@@ -15,22 +25,22 @@
 #undef pr_fmt
 #define pr_fmt(fmt) "%s :" fmt,__func__
 
-// pseudo device memory
-char pcd1_device_buffer[PCD1_MEM_SIZE];
-char pcd2_device_buffer[PCD2_MEM_SIZE];
-char pcd3_device_buffer[PCD3_MEM_SIZE];
-char pcd4_device_buffer[PCD4_MEM_SIZE];
+static unsigned int nr_devices = NO_OF_DEVICES;
+module_param(nr_devices, uint, 0444);
+MODULE_PARM_DESC(nr_devices, "Number of pseudo devices to create (1-4096)");
 
 //Device private data
 struct pcdev_private_data
 {
 	char* buffer;
 	unsigned size;
-	const char* serial_number;
+	char* serial_number;
 	int perm;
 	struct cdev cdev;
     //struct spinlock_t pcdev_lock;
     struct mutex pcdev_lock;
+    //Readers retry on this instead of taking pcdev_lock
+    seqcount_mutex_t pcdev_seq;
 };
 
 //Driver private data structure
@@ -40,50 +50,32 @@ struct pcdrv_private_data
 	dev_t device_number;
 	struct class *class_pcd;
 	struct device *device_pcd;
-	struct pcdev_private_data pcdev_data[NO_OF_DEVICES];
+	//nr_devices entries, allocated at load time
+	struct pcdev_private_data *pcdev_data;
 };
 
 #define RDONLY 0x01
 #define WRONLY 0x10
 #define RDWR 0x11
 
-struct pcdrv_private_data pcdrv_data =
+//Size and permission of device i come from entry i % NO_OF_DEVICES
+static const struct
 {
-	.total_devices = NO_OF_DEVICES,
-	.pcdev_data = {
-		{
-			.buffer = pcd1_device_buffer,
-			.size = PCD1_MEM_SIZE,
-			.serial_number = "PCDEV1XYZ123",
-			.perm = RDONLY
-		},
-		{
-			.buffer = pcd2_device_buffer,
-			.size = PCD2_MEM_SIZE,
-			.serial_number = "PCDEV2XYZ123",
-			.perm = WRONLY
-		},
-		{
-			.buffer = pcd3_device_buffer,
-			.size = PCD3_MEM_SIZE,
-			.serial_number = "PCDEV3XYZ123",
-			.perm = RDWR
-		},
-		{
-			.buffer = pcd4_device_buffer,
-			.size = PCD4_MEM_SIZE,
-			.serial_number = "PCDEV4XYZ123",
-			.perm = RDWR
-		}
-	}
+	unsigned size;
+	int perm;
+} pcdev_templates[NO_OF_DEVICES] = {
+	{ .size = PCD1_MEM_SIZE, .perm = RDONLY },
+	{ .size = PCD2_MEM_SIZE, .perm = WRONLY },
+	{ .size = PCD3_MEM_SIZE, .perm = RDWR },
+	{ .size = PCD4_MEM_SIZE, .perm = RDWR }
 };
 
-loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+struct pcdrv_private_data pcdrv_data;
+
+static loff_t pcd_do_lseek(struct file *filp, loff_t offset, int whence)
 {
 	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
 	int max_size = pcdev_data->size;
-	pr_info("lseek requested\n");
-	pr_info("current file position = %lld\n",filp->f_pos);
 	if(offset > max_size || offset < 0)
 		return -EINVAL;
 	
@@ -109,62 +101,104 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 		return -EINVAL;
 	}
 
-	pr_info("new value of file position = %lld\n",filp->f_pos);
 	return filp->f_pos;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
 {
 	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
 	int max_size = pcdev_data->size;
+	unsigned int seq;
+	char *kbuf;
 	
-    pr_info("read requested for %zu bytes\n", count);
-	pr_info("Current file position = %lld\n", *f_pos);
-	
+	if(*f_pos >= max_size)
+		return 0;
+
 	if((*f_pos + count) > max_size)
 		count = max_size - *f_pos;
+
+	kbuf = kvmalloc(count, GFP_KERNEL);
+	if(!kbuf)
+		return -ENOMEM;
+
+	/*Lockless read: snapshot into a bounce buffer and retry if a writer
+	updated the device meanwhile, so readers never see a torn buffer*/
+	do {
+		seq = read_seqcount_begin(&pcdev_data->pcdev_seq);
+		memcpy(kbuf, &pcdev_data->buffer[*f_pos], count);
+	} while(read_seqcount_retry(&pcdev_data->pcdev_seq, seq));
 	
-	if(copy_to_user(buff, &pcdev_data->buffer[*f_pos], count))
+	if(copy_to_user(buff, kbuf, count)){
+		kvfree(kbuf);
 		return -EFAULT; 
+	}
+	kvfree(kbuf);
 
 	*f_pos += count;
-	pr_info("Number of bytes successfully read = %zu\n", count);
-	pr_info("Updated file position = %lld\n", *f_pos);
 
 	//Return the number of bytes successfully read
 	return count;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
 {
 	struct pcdev_private_data *pcdev_data = (struct pcdev_private_data*)filp->private_data;
 	int max_size = pcdev_data->size;
-	ssize_t ret;
+	char *kbuf;
+
+	if(*f_pos >= max_size)
+		return -ENOMEM;
 
-    mutex_lock(&pcdev_data->pcdev_lock);
-	pr_info("write requested for %zu bytes\n", count);
-	pr_info("Current file position = %lld\n", *f_pos);
-	
 	if((*f_pos + count) > max_size)
 		count = max_size - *f_pos;
 	
-	if(!count){
-		ret = -ENOMEM;
-		goto out;
-	}
-	
-	if(copy_from_user(&pcdev_data->buffer[*f_pos], buff, count)){
-		ret = -EFAULT;
-		goto out;
-	}
+	//Copy from user space outside the lock, the update itself must not sleep
+	kbuf = vmemdup_user(buff, count);
+	if(IS_ERR(kbuf))
+		return PTR_ERR(kbuf);
+
+    mutex_lock(&pcdev_data->pcdev_lock);
+	write_seqcount_begin(&pcdev_data->pcdev_seq);
+	memcpy(&pcdev_data->buffer[*f_pos], kbuf, count);
+	write_seqcount_end(&pcdev_data->pcdev_seq);
+    mutex_unlock(&pcdev_data->pcdev_lock);
+
+	kvfree(kbuf);
 
 	*f_pos += count;
-	ret = count;
-	pr_info("Number of bytes successfully written = %zu\n", count);
-	pr_info("Updated file position = %lld\n", *f_pos);
 
-out:
-    mutex_unlock(&pcdev_data->pcdev_lock);
+	//Return the number of bytes successfully written
+	return count;
+}
+
+//Traced here so that every return path of the file operations is covered
+loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+{
+	loff_t old_pos = filp->f_pos;
+	loff_t ret = pcd_do_lseek(filp, offset, whence);
+
+	trace_pcd_m_lseek(file_inode(filp)->i_rdev, old_pos, offset, whence, ret);
+	return ret;
+}
+
+ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	//Only timed while the event is enabled, latency is 0 otherwise
+	u64 start = trace_pcd_m_read_enabled() ? ktime_get_ns() : 0;
+	ssize_t ret = pcd_do_read(filp, buff, count, f_pos);
+
+	trace_pcd_m_read(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
+	return ret;
+}
+
+ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	u64 start = trace_pcd_m_write_enabled() ? ktime_get_ns() : 0;
+	ssize_t ret = pcd_do_write(filp, buff, count, f_pos);
+
+	trace_pcd_m_write(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
 	return ret;
 }
 
@@ -184,12 +218,9 @@ static int check_permission(int dev_perm, int access_mode)
 
 int pcd_open(struct inode *inode, struct file *filp)
 {
-	int ret, minor_n;
+	int ret;
 	struct pcdev_private_data *pcdev_data;
 
-	minor_n = MINOR(inode->i_rdev);
-	pr_info("minor access = %d\n",minor_n);
-	
 	//Extract dev private data ptr from its member cdev
 	pcdev_data = container_of(inode->i_cdev, struct pcdev_private_data, cdev);
 	
@@ -198,14 +229,14 @@ int pcd_open(struct inode *inode, struct file *filp)
 
 	ret = check_permission(pcdev_data->perm, filp->f_mode);
 
-	!ret ? pr_info("Open successful\n") : pr_info("Open unsuccessful\n");
+	trace_pcd_m_open(inode->i_rdev, filp->f_mode, ret);
 
 	return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filp)
 {
-	pr_info("release successful\n");
+	trace_pcd_m_release(inode->i_rdev);
 	return 0;
 }
 
@@ -220,12 +251,78 @@ struct file_operations pcd_fops=
 };
 
 
+static void pcd_device_destroy(int i)
+{
+	struct pcdev_private_data *pcdev_data = &pcdrv_data.pcdev_data[i];
+
+	device_destroy(pcdrv_data.class_pcd, pcdrv_data.device_number+i);
+	cdev_del(&pcdev_data->cdev);
+	kvfree(pcdev_data->buffer);
+	kfree(pcdev_data->serial_number);
+}
+
+static int pcd_device_create(int i)
+{
+	struct pcdev_private_data *pcdev_data = &pcdrv_data.pcdev_data[i];
+	int ret;
+
+	pr_debug("Device number <major>:<minor> = %d:%d\n", MAJOR(pcdrv_data.device_number+i), MINOR(pcdrv_data.device_number+i));
+
+	pcdev_data->size = pcdev_templates[i % NO_OF_DEVICES].size;
+	pcdev_data->perm = pcdev_templates[i % NO_OF_DEVICES].perm;
+	pcdev_data->buffer = kvzalloc(pcdev_data->size, GFP_KERNEL);
+	pcdev_data->serial_number = kasprintf(GFP_KERNEL, "PCDEV%dXYZ123", i + 1);
+	if(!pcdev_data->buffer || !pcdev_data->serial_number){
+		ret = -ENOMEM;
+		goto free;
+	}
+
+    //Initialize spinlock or mutex
+    //spin_lock_init(&pcdev_data->pcdev_lock);
+    mutex_init(&pcdev_data->pcdev_lock);
+    seqcount_mutex_init(&pcdev_data->pcdev_seq, &pcdev_data->pcdev_lock);
+
+	cdev_init(&pcdev_data->cdev, &pcd_fops);
+
+	//Register device with VFS
+	pcdev_data->cdev.owner = THIS_MODULE;
+	ret = cdev_add(&pcdev_data->cdev, pcdrv_data.device_number+i, 1);
+	if(ret < 0)
+		goto free;
+
+	//populate sysfs with dev information
+	pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd, NULL, pcdrv_data.device_number+i, NULL, "pcdev-%d",i);
+	if(IS_ERR(pcdrv_data.device_pcd))
+	{
+		pr_err("Device creation failed!");
+		ret = PTR_ERR(pcdrv_data.device_pcd);
+		goto cdev_del;
+	}
+	return 0;
+
+cdev_del:
+	cdev_del(&pcdev_data->cdev);
+free:
+	kvfree(pcdev_data->buffer);
+	kfree(pcdev_data->serial_number);
+	return ret;
+}
+
 static int __init pcd_driver_init(void)
 {
 	int ret, i;
-    ret = alloc_chrdev_region(&pcdrv_data.device_number, 0, NO_OF_DEVICES, "pcd_devices");
+
+	if(!nr_devices || nr_devices > MAX_DEVICES)
+		return -EINVAL;
+
+	//Device memory is allocated per device instead of living in .bss
+	pcdrv_data.pcdev_data = kcalloc(nr_devices, sizeof(*pcdrv_data.pcdev_data), GFP_KERNEL);
+	if(!pcdrv_data.pcdev_data)
+		return -ENOMEM;
+
+    ret = alloc_chrdev_region(&pcdrv_data.device_number, 0, nr_devices, "pcd_devices");
 	if(ret < 0)
-		goto out;
+		goto free;
 	
 	//create device class directory under /sys/class
 	pcdrv_data.class_pcd = class_create(THIS_MODULE, "pcd_class");
@@ -236,46 +333,25 @@ static int __init pcd_driver_init(void)
 		goto unreg_chrdev;
 	}
 	
-	for(i=0; i<NO_OF_DEVICES;i++)
+	for(i=0; i<nr_devices;i++)
 	{
-		pr_info("Device number <major>:<minor> = %d:%d\n", MAJOR(pcdrv_data.device_number+i), MINOR(pcdrv_data.device_number+i));
-        
-        //Initialize spinlock or mutex
-        //spin_lock_init(&pcdrv_data.pcdev_data[i].pcdev_lock);
-        mutex_init(&pcdrv_data.pcdev_data[i].pcdev_lock);
-
-		cdev_init(&pcdrv_data.pcdev_data[i].cdev, &pcd_fops);
-	 
-		//Register device with VFS
-		pcdrv_data.pcdev_data[i].cdev.owner = THIS_MODULE;
-		ret = cdev_add(&pcdrv_data.pcdev_data[i].cdev, pcdrv_data.device_number+i, 1);
-		if(ret < 0)
-			goto class_del;
-
-		//populate sysfs with dev information
-		pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd, NULL, pcdrv_data.device_number+i, NULL, "pcdev-%d",i);
-		if(IS_ERR(pcdrv_data.device_pcd))
-		{
-			pr_err("Device creation failed!");
-			ret = PTR_ERR(pcdrv_data.device_pcd);
-			goto cdev_del;
-		}
+		ret = pcd_device_create(i);
+		if(ret)
+			goto dev_del;
 	}
+	pcdrv_data.total_devices = nr_devices;
 	
-	pr_info("Module init was successful\n");
+	pr_info("Module init was successful, %u devices\n", nr_devices);
     return 0;
 
-cdev_del:
-class_del:
-	for(; i>=0; i--)
-	{
-		device_destroy(pcdrv_data.class_pcd, pcdrv_data.device_number+i);
-		cdev_del(&pcdrv_data.pcdev_data[i].cdev);
-	}
+dev_del:
+	while(--i >= 0)
+		pcd_device_destroy(i);
 	class_destroy(pcdrv_data.class_pcd);
 unreg_chrdev:
-	unregister_chrdev_region(pcdrv_data.device_number, NO_OF_DEVICES);
-out:
+	unregister_chrdev_region(pcdrv_data.device_number, nr_devices);
+free:
+	kfree(pcdrv_data.pcdev_data);
 	pr_info("Module insertion failed!\n");
 	return ret;
 }
@@ -283,13 +359,11 @@ out:
 static void __exit pcd_driver_cleanup(void)
 {
 	int i;
-	for(i=0; i<NO_OF_DEVICES; i++)
-	{
-		device_destroy(pcdrv_data.class_pcd, pcdrv_data.device_number+i);
-		cdev_del(&pcdrv_data.pcdev_data[i].cdev);
-	}
+	for(i=0; i<pcdrv_data.total_devices; i++)
+		pcd_device_destroy(i);
 	class_destroy(pcdrv_data.class_pcd);
-	unregister_chrdev_region(pcdrv_data.device_number, NO_OF_DEVICES);
+	unregister_chrdev_region(pcdrv_data.device_number, nr_devices);
+	kfree(pcdrv_data.pcdev_data);
 	pr_info("module unloaded\n");
 }
 
@@ -0,0 +1,51 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pcd_platform
+
+#if !defined(PCD_PLATFORM_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PCD_PLATFORM_TRACE_H
+
+//Layouts are shared with the other pcd modules, the event names are this module's
+#include "pcd_trace_events.h"
+
+DEFINE_EVENT(pcd_io_class, pcd_platform_read,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_io_class, pcd_platform_write,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_lseek_class, pcd_platform_lseek,
+    TP_PROTO(dev_t dev, loff_t old_pos, loff_t offset, int whence, loff_t ret),
+    TP_ARGS(dev, old_pos, offset, whence, ret)
+);
+
+DEFINE_EVENT(pcd_open_class, pcd_platform_open,
+    TP_PROTO(dev_t dev, fmode_t mode, int ret),
+    TP_ARGS(dev, mode, ret)
+);
+
+DEFINE_EVENT(pcd_release_class, pcd_platform_release,
+    TP_PROTO(dev_t dev),
+    TP_ARGS(dev)
+);
+
+DEFINE_EVENT(pcd_probe_class, pcd_platform_probe,
+    TP_PROTO(const char *name, int size, int perm, int ret, u64 latency_ns),
+    TP_ARGS(name, size, perm, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_remove_class, pcd_platform_remove,
+    TP_PROTO(dev_t dev, const char *serial),
+    TP_ARGS(dev, serial)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcd_platform_trace
+#include <trace/define_trace.h>
@@ -4,6 +4,7 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
 #include <linux/platform_device.h>
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
@@ -11,6 +12,9 @@
 #include <linux/slab.h>
 #include "platform.h"
 
+#define CREATE_TRACE_POINTS
+#include "pcd_platform_dt_trace.h"
+
 #undef pr_fmt
 #define pr_fmt(fmt) "%s :" fmt,__func__
 
@@ -67,12 +71,10 @@ struct pcdrv_private_data
 
 struct pcdrv_private_data pcdrv_data;
 
-loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+static loff_t pcd_do_lseek(struct file *filp, loff_t offset, int whence)
 {
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
     int max_size = pcdev_data->pdata.size;
-    pr_info("lseek requested\n");
-    pr_info("current file position = %lld\n", filp->f_pos);
     if (offset > max_size || offset < 0)
         return -EINVAL;
 
@@ -98,18 +100,14 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
         return -EINVAL;
     }
 
-    pr_info("new value of file position = %lld\n", filp->f_pos);
     return filp->f_pos;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
 {
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
     int max_size = pcdev_data->pdata.size;
 
-    pr_info("read requested for %zu bytes\n", count);
-    pr_info("Current file position = %lld\n", *f_pos);
-
     if ((*f_pos + count) > max_size)
         count = max_size - *f_pos;
 
@@ -117,21 +115,16 @@ ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_p
         return -EFAULT;
 
     *f_pos += count;
-    pr_info("Number of bytes successfully read = %zu\n", count);
-    pr_info("Updated file position = %lld\n", *f_pos);
 
     // Return the number of bytes successfully read
     return count;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
 {
     struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
     int max_size = pcdev_data->pdata.size;
 
-    pr_info("write requested for %zu bytes\n", count);
-    pr_info("Current file position = %lld\n", *f_pos);
-
     if ((*f_pos + count) > max_size)
         count = max_size - *f_pos;
 
@@ -142,13 +135,42 @@ ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff
         return -EFAULT;
 
     *f_pos += count;
-    pr_info("Number of bytes successfully written = %zu\n", count);
-    pr_info("Updated file position = %lld\n", *f_pos);
 
     // Return the number of bytes successfully written
     return count;
 }
 
+//Traced here so that every return path of the file operations is covered
+loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+{
+    loff_t old_pos = filp->f_pos;
+    loff_t ret = pcd_do_lseek(filp, offset, whence);
+
+    trace_pcd_platform_dt_lseek(file_inode(filp)->i_rdev, old_pos, offset, whence, ret);
+    return ret;
+}
+
+ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+{
+    loff_t pos = *f_pos;
+    //Only timed while the event is enabled, latency is 0 otherwise
+    u64 start = trace_pcd_platform_dt_read_enabled() ? ktime_get_ns() : 0;
+    ssize_t ret = pcd_do_read(filp, buff, count, f_pos);
+
+    trace_pcd_platform_dt_read(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
+    return ret;
+}
+
+ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+{
+    loff_t pos = *f_pos;
+    u64 start = trace_pcd_platform_dt_write_enabled() ? ktime_get_ns() : 0;
+    ssize_t ret = pcd_do_write(filp, buff, count, f_pos);
+
+    trace_pcd_platform_dt_write(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
+    return ret;
+}
+
 static int check_permission(int dev_perm, int access_mode)
 {
     if (dev_perm == RDWR)
@@ -165,12 +187,9 @@ static int check_permission(int dev_perm, int access_mode)
 
 int pcd_open(struct inode *inode, struct file *filp)
 {
-    int ret, minor_n;
+    int ret;
     struct pcdev_private_data *pcdev_data;
 
-    minor_n = MINOR(inode->i_rdev);
-    pr_info("minor access = %d\n", minor_n);
-
     // Extract dev private data ptr from its member cdev
     pcdev_data = container_of(inode->i_cdev, struct pcdev_private_data, cdev);
 
@@ -179,14 +198,14 @@ int pcd_open(struct inode *inode, struct file *filp)
 
     ret = check_permission(pcdev_data->pdata.perm, filp->f_mode);
 
-    !ret ? pr_info("Open successful\n") : pr_info("Open unsuccessful\n");
+    trace_pcd_platform_dt_open(inode->i_rdev, filp->f_mode, ret);
 
     return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filp)
 {
-	pr_info("release successful\n");
+	trace_pcd_platform_dt_release(inode->i_rdev);
 	return 0;
 }
 
@@ -233,8 +252,7 @@ static struct pcdev_platform_data* pcdev_get_pltdata_from_dt(struct device *dev)
     return pdata;
 }
 
-//Called when matching device is found
-int pcd_platform_driver_probe(struct platform_device* pdev)
+static int pcd_probe_device(struct platform_device* pdev)
 {
     int ret;
     struct pcdev_private_data* dev_data;
@@ -242,8 +260,6 @@ int pcd_platform_driver_probe(struct platform_device* pdev)
     struct device *dev = &pdev->dev;
     struct of_device_id *match;
     int driver_data;
-    
-    dev_info(dev, "Device detected\n");
 
     //Match will be NULL if kernel does not support device tree i.e CONFIG_OF is off
     match = (struct of_device_id*)of_match_device(pdev->dev.driver->of_match_table, dev);
@@ -283,12 +299,8 @@ int pcd_platform_driver_probe(struct platform_device* pdev)
     dev_data->pdata.perm = pdata->perm;
     dev_data->pdata.serial_number = pdata->serial_number;
 
-    pr_info("Device serial number = %s\n",dev_data->pdata.serial_number);
-    pr_info("Device size = %d\n",dev_data->pdata.size);
-    pr_info("Device permission = %d\n",dev_data->pdata.perm);
-
-    pr_info("ConfigItem1 = %d\n", pcdev_config[driver_data].configItem1);
-    pr_info("ConfigItem2 = %d\n", pcdev_config[driver_data].configItem2);
+    pr_debug("ConfigItem1 = %d\n", pcdev_config[driver_data].configItem1);
+    pr_debug("ConfigItem2 = %d\n", pcdev_config[driver_data].configItem2);
     
     //Dynamically allocate mem for device buffer using size info and platform data
     dev_data->buffer = (char*)devm_kzalloc(&pdev->dev, dev_data->pdata.size, GFP_KERNEL);
@@ -319,7 +331,6 @@ int pcd_platform_driver_probe(struct platform_device* pdev)
 
     pcdrv_data.total_devices++;
 
-    pr_info("Probe successful!\n");
     return 0;
 
 cdev_del:
@@ -329,6 +340,19 @@ out:
     return ret;
 }
 
+//Called when matching device is found, the outcome goes to the pcd_platform_dt_probe event
+int pcd_platform_driver_probe(struct platform_device* pdev)
+{
+    struct pcdev_private_data *dev_data;
+    u64 start = ktime_get_ns();
+    int ret = pcd_probe_device(pdev);
+
+    dev_data = ret ? NULL : dev_get_drvdata(&pdev->dev);
+    trace_pcd_platform_dt_probe(dev_name(&pdev->dev), dev_data ? dev_data->pdata.size : 0,
+                                dev_data ? dev_data->pdata.perm : 0, ret, ktime_get_ns() - start);
+    return ret;
+}
+
 //Remove gets called when device is removed from system
 int pcd_platform_driver_remove(struct platform_device* pdev)
 {
@@ -340,8 +364,8 @@ int pcd_platform_driver_remove(struct platform_device* pdev)
     cdev_del(&dev_data->cdev);
 
     pcdrv_data.total_devices--;
-    
-    dev_info(&pdev->dev, "Device removed\n");
+
+    trace_pcd_platform_dt_remove(dev_data->dev_num, dev_data->pdata.serial_number);
     return 0;
 }
 
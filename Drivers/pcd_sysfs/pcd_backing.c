@@ -0,0 +1,238 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/bitmap.h>
+#include <linux/workqueue.h>
+
+//Delay between the first write after a flush and the write-back of dirty pages
+static unsigned int writeback_delay_ms = 100;
+module_param(writeback_delay_ms, uint, 0644);
+MODULE_PARM_DESC(writeback_delay_ms, "Delay in ms before dirty pages are written to the backing file");
+
+/*Write dirty pages back to the backing file. Runs on the driver workqueue, so
+writers only pay for setting a bit. resize_lock keeps the store and dirty map
+stable, page contents are snapshotted like a lockless reader would*/
+static void pcd_backing_writeback(struct work_struct *work)
+{
+    struct pcdev_private_data *dev_data = container_of(to_delayed_work(work), struct pcdev_private_data, writeback_work);
+    struct pcd_store *store;
+    unsigned long i;
+    unsigned int seq;
+    size_t len;
+    loff_t pos;
+    ssize_t ret;
+    bool pending;
+    void *page_buf;
+
+    page_buf = (void*)__get_free_page(GFP_KERNEL);
+    if(!page_buf){
+        //Try again later, dirty bits are still set
+        queue_delayed_work(pcdrv_data.writeback_wq, &dev_data->writeback_work, msecs_to_jiffies(writeback_delay_ms));
+        return;
+    }
+
+    mutex_lock(&dev_data->resize_lock);
+    store = rcu_dereference_protected(dev_data->store, lockdep_is_held(&dev_data->resize_lock));
+
+    if(store->size != dev_data->backing_size){
+        ret = vfs_truncate(&dev_data->backing_file->f_path, store->size);
+        if(!ret)
+            dev_data->backing_size = store->size;
+    }
+
+    for_each_set_bit(i, dev_data->dirty_map, dev_data->dirty_nr){
+        //Clear before the snapshot, a write racing with us dirties the page again
+        if(!test_and_clear_bit(i, dev_data->dirty_map))
+            continue;
+
+        pos = (loff_t)i << PAGE_SHIFT;
+        len = min_t(size_t, PAGE_SIZE, store->size - pos);
+        do {
+            seq = read_seqcount_begin(&dev_data->pcd_seq);
+            pending = pcd_compress_pending(dev_data, pos, len);
+            if(!pending)
+                pcd_store_read(store, pos, page_buf, len);
+        } while(read_seqcount_retry(&dev_data->pcd_seq, seq));
+
+        //Compressed since it was dirtied, snapshot it under pcd_lock instead
+        if(pending){
+            mutex_lock(&dev_data->pcd_lock);
+            ret = pcd_compress_ensure(dev_data, pos, len);
+            if(!ret)
+                pcd_store_read(store, pos, page_buf, len);
+            mutex_unlock(&dev_data->pcd_lock);
+            if(ret){
+                set_bit(i, dev_data->dirty_map);
+                break;
+            }
+        }
+
+        ret = kernel_write(dev_data->backing_file, page_buf, len, &pos);
+        if(ret != (ssize_t)len){
+            set_bit(i, dev_data->dirty_map);
+            pr_warn_ratelimited("write-back of %s failed at page %lu: %zd\n",
+                dev_data->pdata.serial_number, i, ret);
+            break;
+        }
+    }
+
+    mutex_unlock(&dev_data->resize_lock);
+    free_page((unsigned long)page_buf);
+}
+
+//Called with pcd_lock held by every path that modifies the store
+void pcd_backing_mark_dirty(struct pcdev_private_data *dev_data, size_t pos, size_t len)
+{
+    unsigned long first, last;
+
+    if(!dev_data->backing_file || !len)
+        return;
+
+    first = PFN_DOWN(pos);
+    if(first >= dev_data->dirty_nr)
+        return;
+    last = min(PFN_DOWN(pos + len - 1), dev_data->dirty_nr - 1);
+    //Atomic per bit, write-back clears them with test_and_clear_bit() without pcd_lock
+    for(; first <= last; first++)
+        set_bit(first, dev_data->dirty_map);
+
+    //No-op while a write-back is already pending
+    queue_delayed_work(pcdrv_data.writeback_wq, &dev_data->writeback_work, msecs_to_jiffies(writeback_delay_ms));
+}
+
+//Resizes allocate a map for the new size up front and swap it in under pcd_lock
+unsigned long* pcd_backing_alloc_map(struct pcdev_private_data *dev_data, size_t size)
+{
+    if(!dev_data->backing_file)
+        return NULL;
+    return bitmap_zalloc(DIV_ROUND_UP(size, PAGE_SIZE), GFP_KERNEL);
+}
+
+unsigned long* pcd_backing_swap_map(struct pcdev_private_data *dev_data, unsigned long *map, size_t size)
+{
+    unsigned long *old_map = dev_data->dirty_map;
+    unsigned long nr = DIV_ROUND_UP(size, PAGE_SIZE);
+
+    if(!map)
+        return NULL;
+
+    bitmap_copy(map, old_map, min(nr, dev_data->dirty_nr));
+    dev_data->dirty_map = map;
+    dev_data->dirty_nr = nr;
+
+    //Let the next write-back truncate the file to the new size
+    queue_delayed_work(pcdrv_data.writeback_wq, &dev_data->writeback_work, msecs_to_jiffies(writeback_delay_ms));
+    return old_map;
+}
+
+/*Restore the device from its backing file with one sequential pass over the
+pages. Each page is read into a bounce page first so that pages with the same
+contents on other devices, zeros included, end up shared. Runs on the first
+open with resize_lock and pcd_lock held, before anything was written*/
+int pcd_backing_load(struct pcdev_private_data *dev_data)
+{
+    struct pcd_store *store = pcd_locked_store(dev_data);
+    loff_t file_size = i_size_read(file_inode(dev_data->backing_file));
+    size_t len = min_t(loff_t, file_size, store->size);
+    unsigned long index;
+    loff_t pos = 0;
+    ssize_t ret = 0;
+    struct page *page, *old;
+    bool shared;
+    void *buf;
+
+    buf = (void*)get_zeroed_page(GFP_KERNEL);
+    if(!buf)
+        return -ENOMEM;
+
+    while(pos < len){
+        index = PFN_DOWN(pos);
+        ret = kernel_read(dev_data->backing_file, buf + offset_in_page(pos),
+            min_t(size_t, PAGE_SIZE - offset_in_page(pos), len - pos), &pos);
+        if(ret <= 0){
+            ret = ret ? ret : -EIO;
+            break;
+        }
+        //Short reads carry on filling the same page
+        if(offset_in_page(pos) && pos < len)
+            continue;
+
+        page = pcd_cow_lookup(buf, &shared);
+        if(!page){
+            ret = -ENOMEM;
+            break;
+        }
+        write_seqcount_begin(&dev_data->pcd_seq);
+        old = store->pages[index];
+        store->pages[index] = page;
+        if(shared)
+            set_bit(index, store->shared);
+        else
+            clear_bit(index, store->shared);
+        if(store->csum)
+            store->csum[index] = pcd_store_csum_buf(buf);
+        write_seqcount_end(&dev_data->pcd_seq);
+        //Unwritten pages are the zero page, which the driver keeps a reference to
+        put_page(old);
+        memset(buf, 0, PAGE_SIZE);
+        ret = 0;
+    }
+
+    free_page((unsigned long)buf);
+    if(ret)
+        return ret;
+
+    dev_data->backing_size = file_size;
+    return 0;
+}
+
+int pcd_backing_init(struct device *dev, struct pcdev_private_data *dev_data, const char *path)
+{
+    int ret;
+
+    INIT_DELAYED_WORK(&dev_data->writeback_work, pcd_backing_writeback);
+
+    dev_data->backing_file = filp_open(path, O_RDWR | O_CREAT | O_LARGEFILE, 0600);
+    if(IS_ERR(dev_data->backing_file)){
+        ret = PTR_ERR(dev_data->backing_file);
+        dev_data->backing_file = NULL;
+        dev_err(dev, "Can't open backing file %s: %d\n", path, ret);
+        return ret;
+    }
+
+    dev_data->dirty_nr = DIV_ROUND_UP(dev_data->pdata.size, PAGE_SIZE);
+    dev_data->dirty_map = bitmap_zalloc(dev_data->dirty_nr, GFP_KERNEL);
+    if(!dev_data->dirty_map){
+        ret = -ENOMEM;
+        goto close;
+    }
+
+    dev_data->backing_size = i_size_read(file_inode(dev_data->backing_file));
+
+    //Contents are read in on the first open, see pcd_prepare()
+    dev_dbg(dev, "Backed by %s\n", path);
+    return 0;
+
+close:
+    filp_close(dev_data->backing_file, NULL);
+    dev_data->backing_file = NULL;
+    return ret;
+}
+
+//Flush the whole device since mmap writes are only tracked on the first write fault of a page
+void pcd_backing_exit(struct pcdev_private_data *dev_data)
+{
+    if(!dev_data->backing_file)
+        return;
+
+    cancel_delayed_work_sync(&dev_data->writeback_work);
+    //Never opened means never loaded, the file still holds the contents
+    if(smp_load_acquire(&dev_data->ready)){
+        bitmap_fill(dev_data->dirty_map, dev_data->dirty_nr);
+        pcd_backing_writeback(&dev_data->writeback_work.work);
+        cancel_delayed_work_sync(&dev_data->writeback_work);
+        vfs_fsync(dev_data->backing_file, 0);
+    }
+
+    filp_close(dev_data->backing_file, NULL);
+    bitmap_free(dev_data->dirty_map);
+    dev_data->backing_file = NULL;
+}
@@ -0,0 +1,16 @@
+#ifndef PCD_BACKING_H
+#define PCD_BACKING_H
+
+#include <linux/types.h>
+
+struct device;
+struct pcdev_private_data;
+
+int pcd_backing_init(struct device *dev, struct pcdev_private_data *dev_data, const char *path);
+void pcd_backing_exit(struct pcdev_private_data *dev_data);
+int pcd_backing_load(struct pcdev_private_data *dev_data);
+void pcd_backing_mark_dirty(struct pcdev_private_data *dev_data, size_t pos, size_t len);
+unsigned long* pcd_backing_alloc_map(struct pcdev_private_data *dev_data, size_t size);
+unsigned long* pcd_backing_swap_map(struct pcdev_private_data *dev_data, unsigned long *map, size_t size);
+
+#endif
@@ -0,0 +1,273 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_syscalls.h"
+#include "pcd_ioctl.h"
+
+/*Broadcast mode: every write appends one record to a ring of pdata.size
+bytes and every open file reads all records from its own cursor, like a
+pub/sub channel. The writer makes room by overwriting the oldest records and
+never waits for readers. A reader that fell behind skips to the oldest record
+still in the ring and is told how many it lost. Readers take no device lock,
+they snapshot a record under pcd_seq like random access reads do*/
+
+//Ring layout of a record, the payload follows and the next record starts 8 byte aligned
+struct pcd_bcast_rec
+{
+    u64 seq;
+    u32 len;
+    u32 reserved;
+};
+
+#define PCD_BCAST_ALIGN 8
+
+static u64 pcd_bcast_rec_size(size_t len)
+{
+    return ALIGN(sizeof(struct pcd_bcast_rec) + len, PCD_BCAST_ALIGN);
+}
+
+//Copy len bytes from ring position pos, wrapping at the end of the store
+static void pcd_bcast_copy_out(struct pcd_store *store, u64 pos, void *dst, size_t len)
+{
+    size_t off = do_div(pos, store->size);
+    size_t first;
+
+    //A snapshot racing a writer may see any len, it is retried anyway
+    len = min(len, store->size);
+    first = min(len, store->size - off);
+    pcd_store_read(store, off, dst, first);
+    pcd_store_read(store, 0, dst + first, len - first);
+}
+
+static void pcd_bcast_copy_in(struct pcd_store *store, u64 pos, const void *src, size_t len)
+{
+    size_t off = do_div(pos, store->size);
+    size_t first = min(len, store->size - off);
+
+    pcd_store_write(store, off, src, first);
+    pcd_store_write(store, 0, src + first, len - first);
+}
+
+//u64 loads tear on 32 bit, read the sequence counter under pcd_seq
+static u64 pcd_bcast_next_seq(struct pcdev_private_data *dev_data)
+{
+    unsigned int seq;
+    u64 next;
+
+    do {
+        seq = read_seqcount_begin(&dev_data->pcd_seq);
+        next = dev_data->bc_next_seq;
+    } while(read_seqcount_retry(&dev_data->pcd_seq, seq));
+
+    return next;
+}
+
+//New readers only see records written after they opened the device
+void pcd_bcast_open(struct pcd_file *pfile)
+{
+    struct pcdev_private_data *dev_data = pfile->dev_data;
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&dev_data->pcd_seq);
+        pfile->bc_seq = dev_data->bc_next_seq;
+        pfile->bc_pos = dev_data->bc_write_pos;
+    } while(read_seqcount_retry(&dev_data->pcd_seq, seq));
+}
+
+/*Drop every record, called by a resize with pcd_lock held inside the pcd_seq
+section that publishes the new store. Readers count them as missed*/
+void pcd_bcast_reset(struct pcdev_private_data *dev_data)
+{
+    lockdep_assert_held(&dev_data->pcd_lock);
+    dev_data->bc_oldest_seq = dev_data->bc_next_seq;
+    dev_data->bc_oldest_pos = dev_data->bc_write_pos;
+}
+
+ssize_t pcd_bcast_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *dev_data = pcd_file_dev(iocb->ki_filp);
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    size_t len = iov_iter_count(from);
+    struct pcd_bcast_rec rec, old;
+    struct pcd_store *store;
+    u64 need = pcd_bcast_rec_size(len);
+    ssize_t ret;
+    char *kbuf;
+
+    if(!len)
+        return 0;
+
+    //A record is written whole or not at all, it has to fit the ring
+    if(need > READ_ONCE(dev_data->pdata.size))
+        return -EMSGSIZE;
+
+    kbuf = pcd_bounce_alloc(len, nowait);
+    if(!kbuf)
+        return nowait ? -EAGAIN : -ENOMEM;
+
+    if(!copy_from_iter_full(kbuf, len, from)){
+        ret = -EFAULT;
+        goto free;
+    }
+
+    //The device lock is only ever held for a copy, the writer never waits for readers
+    if(nowait){
+        if(!mutex_trylock(&dev_data->pcd_lock)){
+            ret = -EAGAIN;
+            goto revert;
+        }
+    }
+    else {
+        u64 start = ktime_get_ns();
+        mutex_lock(&dev_data->pcd_lock);
+        pcd_stats_account_lock_wait(dev_data, ktime_get_ns() - start);
+    }
+
+    store = pcd_locked_store(dev_data);
+    if(need > store->size){
+        mutex_unlock(&dev_data->pcd_lock);
+        ret = -EMSGSIZE;
+        goto revert;
+    }
+
+    write_seqcount_begin(&dev_data->pcd_seq);
+    //Overwrite the oldest records until the new one fits
+    while(dev_data->bc_write_pos + need - dev_data->bc_oldest_pos > store->size){
+        pcd_bcast_copy_out(store, dev_data->bc_oldest_pos, &old, sizeof(old));
+        dev_data->bc_oldest_pos += pcd_bcast_rec_size(old.len);
+        dev_data->bc_oldest_seq++;
+    }
+    rec.seq = dev_data->bc_next_seq;
+    rec.len = len;
+    rec.reserved = 0;
+    pcd_bcast_copy_in(store, dev_data->bc_write_pos, &rec, sizeof(rec));
+    pcd_bcast_copy_in(store, dev_data->bc_write_pos + sizeof(rec), kbuf, len);
+    dev_data->bc_write_pos += need;
+    dev_data->bc_next_seq++;
+    write_seqcount_end(&dev_data->pcd_seq);
+    mutex_unlock(&dev_data->pcd_lock);
+
+    wake_up_interruptible_poll(&dev_data->fifo_wq, EPOLLIN | EPOLLRDNORM);
+    ret = len;
+    goto free;
+
+revert:
+    iov_iter_revert(from, len);
+free:
+    kvfree(kbuf);
+    return ret;
+}
+
+/*Returns the record at the reader's cursor as a struct pcd_bcast_hdr and as
+much of the payload as fits, the rest of a cut short payload is dropped like
+on a datagram socket*/
+ssize_t pcd_bcast_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcd_file *pfile = iocb->ki_filp->private_data;
+    struct pcdev_private_data *dev_data = pfile->dev_data;
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    size_t count = iov_iter_count(to);
+    struct pcd_bcast_hdr hdr;
+    struct pcd_bcast_rec rec;
+    struct pcd_store *store;
+    size_t bufsize, len = 0;
+    u64 cur, pos, missed;
+    unsigned int seq;
+    bool empty;
+    ssize_t ret;
+    char *kbuf;
+
+    if(count < sizeof(hdr))
+        return -EINVAL;
+
+    //Payloads are staged so the copy to user space happens outside the snapshot
+    bufsize = min_t(size_t, count - sizeof(hdr), READ_ONCE(dev_data->pdata.size));
+    kbuf = pcd_bounce_alloc(bufsize, nowait);
+    if(!kbuf)
+        return nowait ? -EAGAIN : -ENOMEM;
+
+    //Readers sharing a file descriptor share its cursor, each record goes to one of them
+    if(nonblock){
+        if(!mutex_trylock(&pfile->bc_lock)){
+            ret = -EAGAIN;
+            goto free;
+        }
+    }
+    else if(mutex_lock_interruptible(&pfile->bc_lock)){
+        ret = -ERESTARTSYS;
+        goto free;
+    }
+
+    for(;;){
+        rcu_read_lock();
+        do {
+            seq = read_seqcount_begin(&dev_data->pcd_seq);
+            store = rcu_dereference(dev_data->store);
+            cur = pfile->bc_seq;
+            pos = pfile->bc_pos;
+            missed = 0;
+            //Overwritten meanwhile, catch up with the oldest record left
+            if(cur < dev_data->bc_oldest_seq){
+                missed = dev_data->bc_oldest_seq - cur;
+                cur = dev_data->bc_oldest_seq;
+                pos = dev_data->bc_oldest_pos;
+            }
+            empty = cur == dev_data->bc_next_seq;
+            if(!empty){
+                pcd_bcast_copy_out(store, pos, &rec, sizeof(rec));
+                len = min_t(size_t, rec.len, bufsize);
+                pcd_bcast_copy_out(store, pos + sizeof(rec), kbuf, len);
+            }
+        } while(read_seqcount_retry(&dev_data->pcd_seq, seq));
+        rcu_read_unlock();
+
+        if(!empty)
+            break;
+
+        if(nonblock){
+            ret = -EAGAIN;
+            goto unlock;
+        }
+        if(wait_event_interruptible(dev_data->fifo_wq, pcd_bcast_next_seq(dev_data) != pfile->bc_seq)){
+            ret = -ERESTARTSYS;
+            goto unlock;
+        }
+    }
+
+    hdr.seq = rec.seq;
+    hdr.missed = missed;
+    hdr.len = rec.len;
+    hdr.flags = len < rec.len ? PCD_BCAST_TRUNCATED : 0;
+    if(copy_to_iter(&hdr, sizeof(hdr), to) != sizeof(hdr) || copy_to_iter(kbuf, len, to) != len){
+        //The record stays at the cursor for the next read
+        ret = -EFAULT;
+        goto unlock;
+    }
+
+    pfile->bc_seq = cur + 1;
+    pfile->bc_pos = pos + pcd_bcast_rec_size(rec.len);
+    if(missed)
+        pcd_stats_add(dev_data->stats, missed_records, missed);
+    ret = sizeof(hdr) + len;
+
+unlock:
+    mutex_unlock(&pfile->bc_lock);
+free:
+    kvfree(kbuf);
+    return ret;
+}
+
+//Always writable, readable while the reader's cursor is behind the writer
+__poll_t pcd_bcast_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct pcd_file *pfile = filp->private_data;
+    struct pcdev_private_data *dev_data = pfile->dev_data;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+    poll_wait(filp, &dev_data->fifo_wq, wait);
+
+    if(pcd_bcast_next_seq(dev_data) != READ_ONCE(pfile->bc_seq))
+        mask |= EPOLLIN | EPOLLRDNORM;
+
+    return mask;
+}
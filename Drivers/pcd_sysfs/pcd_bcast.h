@@ -0,0 +1,19 @@
+#ifndef PCD_BCAST_H
+#define PCD_BCAST_H
+
+#include <linux/types.h>
+
+struct pcdev_private_data;
+struct pcd_file;
+struct file;
+struct kiocb;
+struct iov_iter;
+struct poll_table_struct;
+
+void pcd_bcast_open(struct pcd_file *pfile);
+void pcd_bcast_reset(struct pcdev_private_data *dev_data);
+ssize_t pcd_bcast_read(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_bcast_write(struct kiocb *iocb, struct iov_iter *from);
+__poll_t pcd_bcast_poll(struct file *filp, struct poll_table_struct *wait);
+
+#endif
@@ -0,0 +1,200 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_syscalls.h"
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/highmem.h>
+
+//Requests in flight per hardware queue
+#define PCD_BLK_QUEUE_DEPTH 128
+
+static int pcd_blk_major;
+
+static int pcd_blk_rw(struct pcdev_private_data *dev_data, struct request *rq)
+{
+    loff_t pos = (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT;
+    struct req_iterator iter;
+    struct bio_vec bvec;
+    ssize_t ret = 0;
+    void *vaddr;
+
+    rq_for_each_segment(bvec, rq, iter){
+        vaddr = bvec_kmap_local(&bvec);
+        if(rq_data_dir(rq) == WRITE)
+            ret = pcd_data_write(dev_data, pos, vaddr, bvec.bv_len, false);
+        else
+            ret = pcd_data_read(dev_data, pos, vaddr, bvec.bv_len, false);
+        kunmap_local(vaddr);
+
+        //Device shrunk below the request since the block layer checked it
+        if(ret != bvec.bv_len)
+            return ret < 0 ? ret : -EIO;
+        pos += bvec.bv_len;
+    }
+    return 0;
+}
+
+/*Requests are served in the context of the submitting CPU's hardware queue.
+Reads are lockless like read_iter, so they scale with the number of queues.
+Writes take pcd_lock per segment since lockless readers rely on pcd_seq, so
+they serialize per device no matter how many queues submit them*/
+static blk_status_t pcd_blk_queue_rq(struct blk_mq_hw_ctx *hctx, const struct blk_mq_queue_data *bd)
+{
+    struct pcdev_private_data *dev_data = hctx->queue->queuedata;
+    struct request *rq = bd->rq;
+    blk_status_t status = BLK_STS_OK;
+    u64 start = ktime_get_ns();
+    int ret;
+
+    blk_mq_start_request(rq);
+
+    switch(req_op(rq)){
+    case REQ_OP_READ:
+    case REQ_OP_WRITE:
+        ret = pcd_blk_rw(dev_data, rq);
+        if(ret)
+            status = errno_to_blk_status(ret);
+
+        if(rq_data_dir(rq) == WRITE)
+            pcd_stats_account_write(dev_data, blk_rq_bytes(rq), ret ? ret : blk_rq_bytes(rq), ktime_get_ns() - start);
+        else
+            pcd_stats_account_read(dev_data, blk_rq_bytes(rq), ret ? ret : blk_rq_bytes(rq), ktime_get_ns() - start);
+        break;
+
+    //Both leave zeros behind, the memory is released rather than kept around zeroed
+    case REQ_OP_DISCARD:
+    case REQ_OP_WRITE_ZEROES:
+        ret = pcd_cow_punch(dev_data, (loff_t)blk_rq_pos(rq) << SECTOR_SHIFT, blk_rq_bytes(rq));
+        if(ret)
+            status = errno_to_blk_status(ret);
+        break;
+
+    //Backed by memory, the backing file write-back is asynchronous anyway
+    case REQ_OP_FLUSH:
+        break;
+
+    default:
+        status = BLK_STS_NOTSUPP;
+        break;
+    }
+
+    blk_mq_end_request(rq, status);
+    return BLK_STS_OK;
+}
+
+static const struct blk_mq_ops pcd_blk_mq_ops = {
+    .queue_rq = pcd_blk_queue_rq
+};
+
+/*Same rules as the char device, checked at open so opens that are already
+there keep their access. Reads are not refused in queue_rq: the page cache
+reads blocks back in for partial writes even on write only devices*/
+static int pcd_blk_open(struct block_device *bdev, fmode_t mode)
+{
+    struct pcdev_private_data *dev_data = bdev->bd_disk->private_data;
+    int ret;
+
+    ret = pcd_check_permission(READ_ONCE(dev_data->pdata.perm), mode);
+    if(ret)
+        return ret;
+    return pcd_prepare(dev_data);
+}
+
+static const struct block_device_operations pcd_blk_fops = {
+    .owner = THIS_MODULE,
+    .open = pcd_blk_open
+};
+
+int pcd_blk_init(void)
+{
+    pcd_blk_major = register_blkdev(0, "pcdblk");
+    return pcd_blk_major < 0 ? pcd_blk_major : 0;
+}
+
+void pcd_blk_exit(void)
+{
+    unregister_blkdev(pcd_blk_major, "pcdblk");
+}
+
+//Expose the device memory as /dev/pcdblk<index> next to the char device
+int pcd_blk_add(struct pcdev_private_data *dev_data, int index)
+{
+    struct blk_mq_tag_set *set = &dev_data->tag_set;
+    struct gendisk *disk;
+    int ret;
+
+    set->ops = &pcd_blk_mq_ops;
+    set->nr_hw_queues = nr_cpu_ids;
+    set->queue_depth = PCD_BLK_QUEUE_DEPTH;
+    set->numa_node = NUMA_NO_NODE;
+    //Writes may sleep on pcd_lock and allocate when copying shared or compressed pages
+    set->flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_BLOCKING;
+
+    ret = blk_mq_alloc_tag_set(set);
+    if(ret)
+        return ret;
+
+    disk = blk_mq_alloc_disk(set, dev_data);
+    if(IS_ERR(disk)){
+        ret = PTR_ERR(disk);
+        goto free_set;
+    }
+
+    disk->major = pcd_blk_major;
+    disk->first_minor = index;
+    disk->minors = 1;
+    disk->fops = &pcd_blk_fops;
+    disk->private_data = dev_data;
+    snprintf(disk->disk_name, DISK_NAME_LEN, "pcdblk%d", index);
+
+    blk_queue_logical_block_size(disk->queue, SECTOR_SIZE);
+    blk_queue_physical_block_size(disk->queue, PAGE_SIZE);
+    blk_queue_flag_set(QUEUE_FLAG_NONROT, disk->queue);
+    blk_queue_flag_clear(QUEUE_FLAG_ADD_RANDOM, disk->queue);
+    //Discards punch holes, fallocate(FALLOC_FL_PUNCH_HOLE) on the block device ends up here
+    disk->queue->limits.discard_granularity = PAGE_SIZE;
+    blk_queue_max_discard_sectors(disk->queue, UINT_MAX >> SECTOR_SHIFT);
+    blk_queue_max_write_zeroes_sectors(disk->queue, UINT_MAX >> SECTOR_SHIFT);
+    set_capacity(disk, dev_data->pdata.size >> SECTOR_SHIFT);
+    set_disk_ro(disk, dev_data->pdata.perm == RDONLY);
+    //Partition scanning opens for reading, which write only devices refuse
+    if(dev_data->pdata.perm == WRONLY)
+        disk->flags |= GENHD_FL_NO_PART;
+
+    ret = add_disk(disk);
+    if(ret)
+        goto put_disk;
+
+    dev_data->disk = disk;
+    return 0;
+
+put_disk:
+    put_disk(disk);
+free_set:
+    blk_mq_free_tag_set(set);
+    return ret;
+}
+
+void pcd_blk_remove(struct pcdev_private_data *dev_data)
+{
+    if(!dev_data->disk)
+        return;
+
+    del_gendisk(dev_data->disk);
+    put_disk(dev_data->disk);
+    blk_mq_free_tag_set(&dev_data->tag_set);
+    dev_data->disk = NULL;
+}
+
+//Follows a permission change, writes through an open read only disk fail from then on
+void pcd_blk_set_perm(struct pcdev_private_data *dev_data)
+{
+    if(dev_data->disk)
+        set_disk_ro(dev_data->disk, READ_ONCE(dev_data->pdata.perm) == RDONLY);
+}
+
+//A trailing partial sector is not reachable through the block device
+void pcd_blk_resize(struct pcdev_private_data *dev_data, size_t size)
+{
+    if(dev_data->disk)
+        set_capacity_and_notify(dev_data->disk, size >> SECTOR_SHIFT);
+}
@@ -0,0 +1,15 @@
+#ifndef PCD_BLK_H
+#define PCD_BLK_H
+
+#include <linux/types.h>
+
+struct pcdev_private_data;
+
+int pcd_blk_init(void);
+void pcd_blk_exit(void);
+int pcd_blk_add(struct pcdev_private_data *dev_data, int index);
+void pcd_blk_remove(struct pcdev_private_data *dev_data);
+void pcd_blk_resize(struct pcdev_private_data *dev_data, size_t size);
+void pcd_blk_set_perm(struct pcdev_private_data *dev_data);
+
+#endif
@@ -0,0 +1,338 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/xarray.h>
+
+//Compressor used for cold pages, any algorithm of the crypto compression API
+static char *compress_algo = "lz4";
+module_param(compress_algo, charp, 0444);
+MODULE_PARM_DESC(compress_algo, "Crypto API compressor for cold pcd pages (lz4, zstd, ...)");
+
+//Pages scanned per pcd_lock hold, keeps writers from stalling behind a full scan
+#define PCD_COMPRESS_BATCH 64
+
+//Pages compressing worse than this stay resident
+#define PCD_COMPRESS_MAX_LEN (PAGE_SIZE * 3 / 4)
+
+struct pcd_zpage
+{
+    unsigned int len;
+    u8 data[];
+};
+
+void pcd_compress_init(struct pcdev_private_data *dev_data)
+{
+    xa_init(&dev_data->zpages);
+}
+
+//Any compressed page in [pos, pos + len), safe without pcd_lock under RCU
+bool pcd_compress_pending(struct pcdev_private_data *dev_data, size_t pos, size_t len)
+{
+    unsigned long index = PFN_DOWN(pos);
+
+    if(!len || xa_empty(&dev_data->zpages))
+        return false;
+    return xa_find(&dev_data->zpages, &index, PFN_DOWN(pos + len - 1), XA_PRESENT) != NULL;
+}
+
+/*Decompress every page in range back into the store. Called with pcd_lock held
+and outside of a pcd_seq write section since it allocates*/
+int pcd_compress_ensure(struct pcdev_private_data *dev_data, size_t pos, size_t len)
+{
+    struct pcd_store *store = pcd_locked_store(dev_data);
+    unsigned long index = PFN_DOWN(pos);
+    struct pcd_zpage *zpage;
+    struct page *page;
+    unsigned int dlen;
+    void *vaddr;
+    int ret;
+
+    if(!pcd_compress_pending(dev_data, pos, len))
+        return 0;
+
+    xa_for_each_range(&dev_data->zpages, index, zpage, PFN_DOWN(pos), PFN_DOWN(pos + len - 1)){
+        page = alloc_page(GFP_HIGHUSER);
+        if(!page)
+            return -ENOMEM;
+
+        dlen = PAGE_SIZE;
+        vaddr = kmap(page);
+        ret = crypto_comp_decompress(dev_data->ztfm, zpage->data, zpage->len, vaddr, &dlen);
+        kunmap(page);
+        if(ret || dlen != PAGE_SIZE){
+            __free_page(page);
+            return ret ? ret : -EIO;
+        }
+
+        write_seqcount_begin(&dev_data->pcd_seq);
+        store->pages[index] = page;
+        write_seqcount_end(&dev_data->pcd_seq);
+
+        xa_erase(&dev_data->zpages, index);
+        dev_data->zpages_nr--;
+        dev_data->zbytes -= zpage->len;
+        kfree(zpage);
+        pcd_stats_add(dev_data->stats, compress_misses, 1);
+    }
+    return 0;
+}
+
+//Decompress page index into dst without bringing it back, pcd_lock held
+int pcd_compress_read(struct pcdev_private_data *dev_data, unsigned long index, void *dst)
+{
+    struct pcd_zpage *zpage = xa_load(&dev_data->zpages, index);
+    unsigned int dlen = PAGE_SIZE;
+    int ret;
+
+    if(!zpage)
+        return -ENOENT;
+
+    ret = crypto_comp_decompress(dev_data->ztfm, zpage->data, zpage->len, dst, &dlen);
+    if(!ret && dlen != PAGE_SIZE)
+        ret = -EIO;
+    return ret;
+}
+
+//Hot path hook, only costs a branch while compression is off
+void pcd_compress_touch(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len)
+{
+    if(!READ_ONCE(dev_data->zinterval_ms))
+        return;
+    pcd_store_touch(store, pos, len);
+    pcd_stats_add(dev_data->stats, compress_hits, 1);
+}
+
+/*Drop the compressed images of pages first to last, for pages cut off by a
+shrink or turned into holes. pcd_lock held*/
+void pcd_compress_discard(struct pcdev_private_data *dev_data, unsigned long first, unsigned long last)
+{
+    struct pcd_zpage *zpage;
+    unsigned long index;
+
+    xa_for_each_range(&dev_data->zpages, index, zpage, first, last){
+        xa_erase(&dev_data->zpages, index);
+        dev_data->zpages_nr--;
+        dev_data->zbytes -= zpage->len;
+        kfree(zpage);
+    }
+}
+
+/*Replace a cold page by its compressed image. The page is frozen first so a
+racing pcd_vm_fault can't take a reference to it, it is freed by the caller
+once lockless readers are done with it*/
+static bool pcd_compress_page(struct pcdev_private_data *dev_data, struct pcd_store *store, unsigned long index)
+{
+    struct page *page = store->pages[index];
+    struct pcd_zpage *zpage;
+    unsigned int dlen = PAGE_SIZE * 2;
+    void *vaddr;
+    int ret;
+
+    //Mapped or otherwise referenced pages stay resident
+    if(!page_ref_freeze(page, 1))
+        return false;
+
+    vaddr = kmap_atomic(page);
+    ret = crypto_comp_compress(dev_data->ztfm, vaddr, PAGE_SIZE, dev_data->zscratch, &dlen);
+    kunmap_atomic(vaddr);
+    if(ret || dlen > PCD_COMPRESS_MAX_LEN)
+        goto unfreeze;
+
+    zpage = kmalloc(struct_size(zpage, data, dlen), GFP_KERNEL);
+    if(!zpage)
+        goto unfreeze;
+    zpage->len = dlen;
+    memcpy(zpage->data, dev_data->zscratch, dlen);
+
+    if(xa_err(xa_store(&dev_data->zpages, index, zpage, GFP_KERNEL))){
+        kfree(zpage);
+        goto unfreeze;
+    }
+
+    write_seqcount_begin(&dev_data->pcd_seq);
+    store->pages[index] = NULL;
+    write_seqcount_end(&dev_data->pcd_seq);
+
+    page_ref_unfreeze(page, 1);
+    dev_data->zpages_nr++;
+    dev_data->zbytes += dlen;
+    return true;
+
+unfreeze:
+    page_ref_unfreeze(page, 1);
+    return false;
+}
+
+/*Compress resident pages that were not accessed during the last interval.
+Access bits are cleared as we go, so a page has a full interval to be touched.
+resize_lock keeps a resize from sharing a page we are about to free*/
+static void pcd_compress_scan(struct work_struct *work)
+{
+    struct pcdev_private_data *dev_data = container_of(to_delayed_work(work), struct pcdev_private_data, zscan_work);
+    struct page *freed[PCD_COMPRESS_BATCH];
+    struct pcd_store *store;
+    unsigned long index = 0, end, nr_pages;
+    unsigned int interval, nr, i;
+
+    do {
+        nr = 0;
+        mutex_lock(&dev_data->resize_lock);
+        mutex_lock(&dev_data->pcd_lock);
+        store = pcd_locked_store(dev_data);
+        nr_pages = store->nr_pages;
+        end = min(index + PCD_COMPRESS_BATCH, nr_pages);
+        for(; index < end; index++){
+            //Pages waiting for write-back are about to be read anyway
+            if(!store->pages[index] || test_and_clear_bit(index, store->accessed) ||
+                    (dev_data->dirty_map && index < dev_data->dirty_nr && test_bit(index, dev_data->dirty_map)))
+                continue;
+            freed[nr] = store->pages[index];
+            if(pcd_compress_page(dev_data, store, index))
+                nr++;
+        }
+        mutex_unlock(&dev_data->pcd_lock);
+        mutex_unlock(&dev_data->resize_lock);
+
+        //Lockless readers may still be copying from the pages
+        if(nr){
+            synchronize_rcu();
+            for(i = 0; i < nr; i++)
+                __free_page(freed[i]);
+        }
+        cond_resched();
+    } while(index < nr_pages);
+
+    interval = READ_ONCE(dev_data->zinterval_ms);
+    if(interval)
+        queue_delayed_work(system_unbound_wq, &dev_data->zscan_work, msecs_to_jiffies(interval));
+}
+
+void pcd_compress_exit(struct pcdev_private_data *dev_data)
+{
+    struct pcd_zpage *zpage;
+    unsigned long index;
+
+    WRITE_ONCE(dev_data->zinterval_ms, 0);
+    if(dev_data->ztfm)
+        cancel_delayed_work_sync(&dev_data->zscan_work);
+
+    xa_for_each(&dev_data->zpages, index, zpage)
+        kfree(zpage);
+    xa_destroy(&dev_data->zpages);
+
+    if(dev_data->ztfm)
+        crypto_free_comp(dev_data->ztfm);
+    kfree(dev_data->zscratch);
+}
+
+//0 disables the scanner, compressed pages are then only brought back on access
+int pcd_compress_set_interval(struct pcdev_private_data *dev_data, unsigned int interval)
+{
+    struct crypto_comp *tfm;
+
+    //Ring offsets move all the time, only random access devices are compressed
+    if(interval && dev_data->pdata.mode != PCD_MODE_RANDOM)
+        return -EINVAL;
+
+    mutex_lock(&dev_data->pcd_lock);
+    if(interval && !dev_data->ztfm){
+        tfm = crypto_alloc_comp(compress_algo, 0, 0);
+        if(IS_ERR(tfm)){
+            mutex_unlock(&dev_data->pcd_lock);
+            return PTR_ERR(tfm);
+        }
+
+        dev_data->zscratch = kmalloc(PAGE_SIZE * 2, GFP_KERNEL);
+        if(!dev_data->zscratch){
+            crypto_free_comp(tfm);
+            mutex_unlock(&dev_data->pcd_lock);
+            return -ENOMEM;
+        }
+        INIT_DELAYED_WORK(&dev_data->zscan_work, pcd_compress_scan);
+        dev_data->ztfm = tfm;
+    }
+    WRITE_ONCE(dev_data->zinterval_ms, interval);
+    mutex_unlock(&dev_data->pcd_lock);
+
+    if(interval)
+        mod_delayed_work(system_unbound_wq, &dev_data->zscan_work, msecs_to_jiffies(interval));
+    else if(dev_data->ztfm)
+        cancel_delayed_work_sync(&dev_data->zscan_work);
+
+    return 0;
+}
+
+static ssize_t show_interval_ms(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%u\n",READ_ONCE(dev_data->zinterval_ms));
+}
+
+static ssize_t store_interval_ms(struct device *dev, struct device_attribute *attr, const char* buf, size_t count)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    unsigned int interval;
+    int ret;
+
+    ret = kstrtouint(buf, 0, &interval);
+    if(ret)
+        return ret;
+
+    ret = pcd_compress_set_interval(dev_data, interval);
+    return ret ? ret : count;
+}
+
+static ssize_t show_algorithm(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    return sprintf(buf,"%s\n",compress_algo);
+}
+
+static ssize_t show_compressed_pages(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%lu\n",READ_ONCE(dev_data->zpages_nr));
+}
+
+static ssize_t show_compressed_bytes(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%zu\n",READ_ONCE(dev_data->zbytes));
+}
+
+//Original over compressed size of the compressed pages, with two decimals
+static ssize_t show_ratio(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    u64 orig, compr, ratio;
+    u32 rem;
+
+    mutex_lock(&dev_data->pcd_lock);
+    orig = (u64)dev_data->zpages_nr * PAGE_SIZE;
+    compr = dev_data->zbytes;
+    mutex_unlock(&dev_data->pcd_lock);
+
+    ratio = compr ? div64_u64(orig * 100, compr) : 0;
+    ratio = div_u64_rem(ratio, 100, &rem);
+    return sprintf(buf,"%llu.%02u\n",ratio,rem);
+}
+
+static DEVICE_ATTR(interval_ms, S_IRUGO | S_IWUSR, show_interval_ms, store_interval_ms);
+static DEVICE_ATTR(algorithm, S_IRUGO, show_algorithm, NULL);
+static DEVICE_ATTR(compressed_pages, S_IRUGO, show_compressed_pages, NULL);
+static DEVICE_ATTR(compressed_bytes, S_IRUGO, show_compressed_bytes, NULL);
+static DEVICE_ATTR(ratio, S_IRUGO, show_ratio, NULL);
+
+struct attribute* pcd_compress_attrs[] = {
+    &dev_attr_interval_ms.attr,
+    &dev_attr_algorithm.attr,
+    &dev_attr_compressed_pages.attr,
+    &dev_attr_compressed_bytes.attr,
+    &dev_attr_ratio.attr,
+    NULL
+};
+
+//Shows up as the compress/ directory of each pcdev
+struct attribute_group pcd_compress_attr_group = {
+    .name = "compress",
+    .attrs = pcd_compress_attrs
+};
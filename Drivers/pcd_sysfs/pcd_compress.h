@@ -0,0 +1,21 @@
+#ifndef PCD_COMPRESS_H
+#define PCD_COMPRESS_H
+
+#include <linux/types.h>
+#include <linux/sysfs.h>
+
+struct pcdev_private_data;
+struct pcd_store;
+
+void pcd_compress_init(struct pcdev_private_data *dev_data);
+void pcd_compress_exit(struct pcdev_private_data *dev_data);
+int pcd_compress_set_interval(struct pcdev_private_data *dev_data, unsigned int interval);
+bool pcd_compress_pending(struct pcdev_private_data *dev_data, size_t pos, size_t len);
+int pcd_compress_ensure(struct pcdev_private_data *dev_data, size_t pos, size_t len);
+int pcd_compress_read(struct pcdev_private_data *dev_data, unsigned long index, void *dst);
+void pcd_compress_touch(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len);
+void pcd_compress_discard(struct pcdev_private_data *dev_data, unsigned long first, unsigned long last);
+
+extern struct attribute_group pcd_compress_attr_group;
+
+#endif
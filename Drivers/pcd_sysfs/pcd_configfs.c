@@ -0,0 +1,268 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_configfs.h"
+#include <linux/configfs.h>
+
+/*Devices created at run time under /sys/kernel/config/pcd. mkdir describes a
+device, writing 1 to enable registers a platform device with the description
+as its platform data, which the driver probes like the ones from
+pcd_device_setup.c. No DT overlay and no unbind/rebind cycle is involved*/
+
+#define PCD_CFG_SERIAL_MAX 32
+
+//Platform device id the runtime devices bind with, their config comes from pcdev_config
+#define PCD_CFG_DEVICE_NAME "pcdev-A1x"
+
+struct pcd_cfg_dev
+{
+    struct config_item item;
+    //Serializes attribute writes against enable
+    struct mutex lock;
+    struct pcdev_platform_data pdata;
+    char serial[PCD_CFG_SERIAL_MAX];
+    //Set while enabled
+    struct platform_device *pdev;
+};
+
+static inline struct pcd_cfg_dev* to_pcd_cfg_dev(struct config_item *item)
+{
+    return container_of(item, struct pcd_cfg_dev, item);
+}
+
+//Settings are copied at enable, they are fixed until the device is disabled again
+static int pcd_cfg_lock(struct pcd_cfg_dev *cfg)
+{
+    mutex_lock(&cfg->lock);
+    if(cfg->pdev){
+        mutex_unlock(&cfg->lock);
+        return -EBUSY;
+    }
+    return 0;
+}
+
+static ssize_t pcd_cfg_size_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%d\n", to_pcd_cfg_dev(item)->pdata.size);
+}
+
+static ssize_t pcd_cfg_size_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+    int size, ret;
+
+    ret = kstrtoint(page, 0, &size);
+    if(ret)
+        return ret;
+    if(size <= 0)
+        return -EINVAL;
+
+    ret = pcd_cfg_lock(cfg);
+    if(ret)
+        return ret;
+    cfg->pdata.size = size;
+    mutex_unlock(&cfg->lock);
+    return count;
+}
+
+static ssize_t pcd_cfg_perm_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "0x%x\n", to_pcd_cfg_dev(item)->pdata.perm);
+}
+
+static ssize_t pcd_cfg_perm_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+    int perm, ret;
+
+    //Same encoding as the org,perm property
+    ret = kstrtoint(page, 0, &perm);
+    if(ret)
+        return ret;
+    if(perm != RDWR && perm != RDONLY && perm != WRONLY)
+        return -EINVAL;
+
+    ret = pcd_cfg_lock(cfg);
+    if(ret)
+        return ret;
+    cfg->pdata.perm = perm;
+    mutex_unlock(&cfg->lock);
+    return count;
+}
+
+static ssize_t pcd_cfg_serial_num_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%s\n", to_pcd_cfg_dev(item)->serial);
+}
+
+static ssize_t pcd_cfg_serial_num_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+    size_t len = strcspn(page, "\n");
+    int ret;
+
+    if(!len || len >= PCD_CFG_SERIAL_MAX)
+        return -EINVAL;
+
+    ret = pcd_cfg_lock(cfg);
+    if(ret)
+        return ret;
+    memcpy(cfg->serial, page, len);
+    cfg->serial[len] = '\0';
+    mutex_unlock(&cfg->lock);
+    return count;
+}
+
+static ssize_t pcd_cfg_mode_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%s\n", pcd_mode_name(to_pcd_cfg_dev(item)->pdata.mode));
+}
+
+static ssize_t pcd_cfg_mode_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+    int mode, ret;
+
+    mode = pcd_mode_from_name(page);
+    if(mode < 0)
+        return -EINVAL;
+
+    ret = pcd_cfg_lock(cfg);
+    if(ret)
+        return ret;
+    cfg->pdata.mode = mode;
+    mutex_unlock(&cfg->lock);
+    return count;
+}
+
+static ssize_t pcd_cfg_enable_show(struct config_item *item, char *page)
+{
+    return sprintf(page, "%d\n", READ_ONCE(to_pcd_cfg_dev(item)->pdev) != NULL);
+}
+
+/*Registering only queues the probe, the driver probes asynchronously. The
+char device shows up under /dev like one from a DT node once it ran*/
+static ssize_t pcd_cfg_enable_store(struct config_item *item, const char *page, size_t count)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+    struct platform_device *pdev;
+    bool enable;
+    int ret;
+
+    ret = kstrtobool(page, &enable);
+    if(ret)
+        return ret;
+
+    mutex_lock(&cfg->lock);
+    if(enable && !cfg->pdev){
+        //Platform data is copied and the driver keeps its own copy of the serial number
+        pdev = platform_device_register_data(NULL, PCD_CFG_DEVICE_NAME, PLATFORM_DEVID_AUTO,
+            &cfg->pdata, sizeof(cfg->pdata));
+        if(IS_ERR(pdev))
+            ret = PTR_ERR(pdev);
+        else
+            cfg->pdev = pdev;
+    }
+    else if(!enable && cfg->pdev){
+        platform_device_unregister(cfg->pdev);
+        cfg->pdev = NULL;
+    }
+    mutex_unlock(&cfg->lock);
+
+    return ret ? ret : count;
+}
+
+CONFIGFS_ATTR(pcd_cfg_, size);
+CONFIGFS_ATTR(pcd_cfg_, perm);
+CONFIGFS_ATTR(pcd_cfg_, serial_num);
+CONFIGFS_ATTR(pcd_cfg_, mode);
+CONFIGFS_ATTR(pcd_cfg_, enable);
+
+static struct configfs_attribute *pcd_cfg_attrs[] = {
+    &pcd_cfg_attr_size,
+    &pcd_cfg_attr_perm,
+    &pcd_cfg_attr_serial_num,
+    &pcd_cfg_attr_mode,
+    &pcd_cfg_attr_enable,
+    NULL
+};
+
+static void pcd_cfg_release(struct config_item *item)
+{
+    kfree(to_pcd_cfg_dev(item));
+}
+
+static struct configfs_item_operations pcd_cfg_item_ops = {
+    .release = pcd_cfg_release
+};
+
+static const struct config_item_type pcd_cfg_dev_type = {
+    .ct_item_ops = &pcd_cfg_item_ops,
+    .ct_attrs = pcd_cfg_attrs,
+    .ct_owner = THIS_MODULE
+};
+
+static struct config_item* pcd_cfg_make_item(struct config_group *group, const char *name)
+{
+    struct pcd_cfg_dev *cfg;
+
+    cfg = kzalloc(sizeof(*cfg), GFP_KERNEL);
+    if(!cfg)
+        return ERR_PTR(-ENOMEM);
+
+    mutex_init(&cfg->lock);
+    //A page sized read-write buffer named after the directory until told otherwise
+    cfg->pdata.size = PAGE_SIZE;
+    cfg->pdata.perm = RDWR;
+    cfg->pdata.mode = PCD_MODE_RANDOM;
+    strscpy(cfg->serial, name, sizeof(cfg->serial));
+    cfg->pdata.serial_number = cfg->serial;
+
+    config_item_init_type_name(&cfg->item, name, &pcd_cfg_dev_type);
+    return &cfg->item;
+}
+
+//rmdir of an enabled device removes it first
+static void pcd_cfg_drop_item(struct config_group *group, struct config_item *item)
+{
+    struct pcd_cfg_dev *cfg = to_pcd_cfg_dev(item);
+
+    mutex_lock(&cfg->lock);
+    if(cfg->pdev){
+        platform_device_unregister(cfg->pdev);
+        cfg->pdev = NULL;
+    }
+    mutex_unlock(&cfg->lock);
+
+    config_item_put(item);
+}
+
+static struct configfs_group_operations pcd_cfg_group_ops = {
+    .make_item = pcd_cfg_make_item,
+    .drop_item = pcd_cfg_drop_item
+};
+
+static const struct config_item_type pcd_cfg_group_type = {
+    .ct_group_ops = &pcd_cfg_group_ops,
+    .ct_owner = THIS_MODULE
+};
+
+static struct configfs_subsystem pcd_cfg_subsys = {
+    .su_group = {
+        .cg_item = {
+            .ci_namebuf = "pcd",
+            .ci_type = &pcd_cfg_group_type
+        }
+    }
+};
+
+int pcd_configfs_init(void)
+{
+    config_group_init(&pcd_cfg_subsys.su_group);
+    mutex_init(&pcd_cfg_subsys.su_mutex);
+    return configfs_register_subsystem(&pcd_cfg_subsys);
+}
+
+//Items pin the module, none are left by the time this runs
+void pcd_configfs_exit(void)
+{
+    configfs_unregister_subsystem(&pcd_cfg_subsys);
+}
@@ -0,0 +1,7 @@
+#ifndef PCD_CONFIGFS_H
+#define PCD_CONFIGFS_H
+
+int pcd_configfs_init(void);
+void pcd_configfs_exit(void);
+
+#endif
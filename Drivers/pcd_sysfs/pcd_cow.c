@@ -0,0 +1,372 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/highmem.h>
+
+/*Pages restored with the same contents are shared by all devices holding them.
+The table keeps its own reference, so a page listed here is never written in
+place: every device sees it as shared and copies it on its first write*/
+struct pcd_cow_entry
+{
+    struct hlist_node node;
+    u32 hash;
+    struct page *page;
+};
+
+//Pages released per pcd_lock hold when punching holes, freed after one grace period
+#define PCD_PUNCH_BATCH 64
+
+static DEFINE_HASHTABLE(pcd_cow_table, 8);
+static DEFINE_MUTEX(pcd_cow_mutex);
+
+static void pcd_cow_prune(struct work_struct *work);
+static DECLARE_WORK(pcd_cow_prune_work, pcd_cow_prune);
+
+int pcd_cow_init(void)
+{
+    void *vaddr;
+
+    pcdrv_data.zero_page = alloc_page(GFP_HIGHUSER | __GFP_ZERO);
+    if(!pcdrv_data.zero_page)
+        return -ENOMEM;
+
+    //Checksum of every hole on devices with integrity checking
+    vaddr = kmap_atomic(pcdrv_data.zero_page);
+    pcdrv_data.zero_csum = pcd_store_csum_buf(vaddr);
+    kunmap_atomic(vaddr);
+    return 0;
+}
+
+void pcd_cow_exit(void)
+{
+    struct pcd_cow_entry *entry;
+    struct hlist_node *tmp;
+    int bkt;
+
+    flush_work(&pcd_cow_prune_work);
+    hash_for_each_safe(pcd_cow_table, bkt, tmp, entry, node){
+        hash_del(&entry->node);
+        put_page(entry->page);
+        kfree(entry);
+    }
+    put_page(pcdrv_data.zero_page);
+}
+
+/*Drop table entries no device uses anymore. Readers that picked up such a page
+before their device copied it may still be reading, hence the grace period*/
+static void pcd_cow_prune(struct work_struct *work)
+{
+    struct pcd_cow_entry *entry;
+    struct hlist_node *tmp;
+    HLIST_HEAD(dead);
+    int bkt;
+
+    mutex_lock(&pcd_cow_mutex);
+    hash_for_each_safe(pcd_cow_table, bkt, tmp, entry, node){
+        if(page_count(entry->page) == 1){
+            hash_del(&entry->node);
+            hlist_add_head(&entry->node, &dead);
+        }
+    }
+    mutex_unlock(&pcd_cow_mutex);
+
+    if(hlist_empty(&dead))
+        return;
+
+    synchronize_rcu();
+    hlist_for_each_entry_safe(entry, tmp, &dead, node){
+        put_page(entry->page);
+        kfree(entry);
+    }
+}
+
+/*Page holding the PAGE_SIZE bytes at buf, with a reference for the caller.
+An existing page with the same contents is reused when there is one, *shared
+tells whether the returned page must be copied before it is written*/
+struct page* pcd_cow_lookup(const void *buf, bool *shared)
+{
+    struct pcd_cow_entry *entry;
+    struct page *page;
+    void *vaddr;
+    bool same;
+    u32 hash;
+
+    *shared = true;
+    if(!memchr_inv(buf, 0, PAGE_SIZE)){
+        get_page(pcdrv_data.zero_page);
+        return pcdrv_data.zero_page;
+    }
+
+    hash = jhash(buf, PAGE_SIZE, 0);
+
+    mutex_lock(&pcd_cow_mutex);
+    hash_for_each_possible(pcd_cow_table, entry, node, hash){
+        if(entry->hash != hash)
+            continue;
+        vaddr = kmap_atomic(entry->page);
+        same = !memcmp(vaddr, buf, PAGE_SIZE);
+        kunmap_atomic(vaddr);
+        if(same){
+            get_page(entry->page);
+            mutex_unlock(&pcd_cow_mutex);
+            return entry->page;
+        }
+    }
+
+    page = alloc_page(GFP_HIGHUSER);
+    if(!page){
+        mutex_unlock(&pcd_cow_mutex);
+        return NULL;
+    }
+    vaddr = kmap_atomic(page);
+    memcpy(vaddr, buf, PAGE_SIZE);
+    kunmap_atomic(vaddr);
+
+    //Without a table entry the page simply stays private to the caller
+    entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+    if(entry){
+        entry->hash = hash;
+        entry->page = page;
+        get_page(page);
+        hash_add(pcd_cow_table, &entry->node, hash);
+    }
+    *shared = entry != NULL;
+    mutex_unlock(&pcd_cow_mutex);
+
+    return page;
+}
+
+//Any shared page in [pos, pos + len)
+bool pcd_cow_pending(struct pcd_store *store, size_t pos, size_t len)
+{
+    unsigned long last;
+
+    if(!len)
+        return false;
+    last = PFN_DOWN(pos + len - 1);
+    return find_next_bit(store->shared, last + 1, PFN_DOWN(pos)) <= last;
+}
+
+/*Give the device its own copy of every shared page in range. Called with
+pcd_lock held and outside of a pcd_seq write section since it allocates.
+The shared page itself is still referenced by the table or the driver, so
+dropping our reference never frees it under a lockless reader*/
+int pcd_cow_break(struct pcdev_private_data *dev_data, size_t pos, size_t len)
+{
+    struct pcd_store *store = pcd_locked_store(dev_data);
+    struct page *page, *old;
+    unsigned long i, last;
+    bool broke = false;
+
+    if(!pcd_cow_pending(store, pos, len))
+        return 0;
+
+    last = PFN_DOWN(pos + len - 1);
+    for(i = PFN_DOWN(pos); i <= last; i++){
+        if(!test_bit(i, store->shared))
+            continue;
+
+        old = store->pages[i];
+        page = pcd_store_copy_page(old);
+        if(!page)
+            return -ENOMEM;
+
+        write_seqcount_begin(&dev_data->pcd_seq);
+        store->pages[i] = page;
+        clear_bit(i, store->shared);
+        write_seqcount_end(&dev_data->pcd_seq);
+
+        //Existing user mappings still point at the shared page
+        pcd_unmap_range(dev_data, (loff_t)i << PAGE_SHIFT, PAGE_SIZE);
+        put_page(old);
+        broke = true;
+    }
+
+    if(broke)
+        schedule_work(&pcd_cow_prune_work);
+    return 0;
+}
+
+//Pages shared through the table with other slots or devices, holes backed by the zero page are not counted
+unsigned long pcd_cow_shared_pages(struct pcdev_private_data *dev_data)
+{
+    struct pcd_store *store;
+    unsigned long i, nr = 0;
+
+    rcu_read_lock();
+    store = rcu_dereference(dev_data->store);
+    for_each_set_bit(i, store->shared, store->nr_pages)
+        if(READ_ONCE(store->pages[i]) != pcdrv_data.zero_page)
+            nr++;
+    rcu_read_unlock();
+
+    return nr;
+}
+
+/*Memory held by the device: private pages plus compressed images. Holes and
+pages shared through the table are not counted, see shared_pages for the latter*/
+size_t pcd_cow_resident_bytes(struct pcdev_private_data *dev_data)
+{
+    struct pcd_store *store;
+    unsigned long nr, resident;
+
+    rcu_read_lock();
+    store = rcu_dereference(dev_data->store);
+    //Compressed slots are neither private nor shared, counters may lag behind a resize
+    nr = bitmap_weight(store->shared, store->nr_pages) + READ_ONCE(dev_data->zpages_nr);
+    resident = nr < store->nr_pages ? store->nr_pages - nr : 0;
+    rcu_read_unlock();
+
+    return (resident << PAGE_SHIFT) + READ_ONCE(dev_data->zbytes);
+}
+
+static bool pcd_cow_is_hole(struct pcd_store *store, unsigned long index)
+{
+    return test_bit(index, store->shared) && READ_ONCE(store->pages[index]) == pcdrv_data.zero_page;
+}
+
+/*SEEK_DATA and SEEK_HOLE at page granularity. Holes are the pages still backed
+by the zero page, compressed pages are data. The end of the device counts as
+a hole, offsets at or past it get -ENXIO*/
+loff_t pcd_cow_seek(struct pcdev_private_data *dev_data, loff_t offset, int whence)
+{
+    struct pcd_store *store;
+    unsigned long i;
+    loff_t ret;
+
+    rcu_read_lock();
+    store = rcu_dereference(dev_data->store);
+    if(offset < 0 || offset >= store->size){
+        rcu_read_unlock();
+        return -ENXIO;
+    }
+
+    for(i = PFN_DOWN(offset); i < store->nr_pages; i++)
+        if(pcd_cow_is_hole(store, i) == (whence == SEEK_HOLE))
+            break;
+
+    if(i < store->nr_pages)
+        ret = max_t(loff_t, offset, (loff_t)i << PAGE_SHIFT);
+    else
+        ret = whence == SEEK_HOLE ? store->size : -ENXIO;
+    rcu_read_unlock();
+
+    return ret;
+}
+
+//Clear [pos, pos + len) in place, for the parts of a hole punch that don't cover whole pages
+static int pcd_cow_zero(struct pcdev_private_data *dev_data, size_t pos, size_t len)
+{
+    struct pcd_store *store = pcd_locked_store(dev_data);
+    size_t offset, chunk;
+    int ret;
+
+    for(; len; pos += chunk, len -= chunk){
+        offset = offset_in_page(pos);
+        chunk = min_t(size_t, len, PAGE_SIZE - offset);
+        if(pcd_cow_is_hole(store, PFN_DOWN(pos)))
+            continue;
+
+        ret = pcd_compress_ensure(dev_data, pos, chunk);
+        if(!ret)
+            ret = pcd_cow_break(dev_data, pos, chunk);
+        if(ret)
+            return ret;
+
+        write_seqcount_begin(&dev_data->pcd_seq);
+        zero_user_segment(store->pages[PFN_DOWN(pos)], offset, offset + chunk);
+        pcd_integrity_update(dev_data, store, pos, chunk);
+        write_seqcount_end(&dev_data->pcd_seq);
+    }
+    return 0;
+}
+
+/*Point pages first to last - 1 back at the zero page and drop their compressed
+images. The replaced pages are returned in old, lockless readers may still be
+using them*/
+static unsigned int pcd_cow_hole(struct pcdev_private_data *dev_data, unsigned long first, unsigned long last, struct page **old)
+{
+    struct pcd_store *store = pcd_locked_store(dev_data);
+    unsigned int nr = 0;
+    unsigned long i;
+
+    write_seqcount_begin(&dev_data->pcd_seq);
+    for(i = first; i < last; i++){
+        if(pcd_cow_is_hole(store, i))
+            continue;
+        //NULL slots are compressed pages
+        if(store->pages[i])
+            old[nr++] = store->pages[i];
+        get_page(pcdrv_data.zero_page);
+        store->pages[i] = pcdrv_data.zero_page;
+        set_bit(i, store->shared);
+        if(store->csum)
+            store->csum[i] = pcdrv_data.zero_csum;
+    }
+    write_seqcount_end(&dev_data->pcd_seq);
+
+    pcd_compress_discard(dev_data, first, last - 1);
+    return nr;
+}
+
+/*Release the memory behind [pos, pos + len), the range reads as zeros
+afterwards. Whole pages become holes again, partial pages are cleared. A range
+running to the end of the device takes the last page with it, the bytes
+past size are zero anyway*/
+int pcd_cow_punch(struct pcdev_private_data *dev_data, loff_t pos, loff_t len)
+{
+    struct page *old[PCD_PUNCH_BATCH];
+    unsigned long first, last, index, end_index;
+    unsigned int nr, i;
+    size_t size, end;
+    int ret = 0;
+
+    if(pos < 0 || len <= 0)
+        return -EINVAL;
+
+    //Keeps resizes and the cold page scanner away from the store until all batches are done
+    mutex_lock(&dev_data->resize_lock);
+    mutex_lock(&dev_data->pcd_lock);
+
+    size = pcd_locked_store(dev_data)->size;
+    if(pos >= size)
+        goto unlock;
+    end = pos + min_t(loff_t, len, size - pos);
+
+    first = PFN_UP(pos);
+    last = end == size ? PFN_UP(end) : PFN_DOWN(end);
+    if(first >= last)
+        ret = pcd_cow_zero(dev_data, pos, end - pos);
+    else {
+        ret = pcd_cow_zero(dev_data, pos, ((size_t)first << PAGE_SHIFT) - pos);
+        if(!ret && end > ((size_t)last << PAGE_SHIFT))
+            ret = pcd_cow_zero(dev_data, (size_t)last << PAGE_SHIFT, end - ((size_t)last << PAGE_SHIFT));
+    }
+    if(ret)
+        goto unlock;
+    pcd_backing_mark_dirty(dev_data, pos, end - pos);
+
+    for(index = first; index < last; index = end_index){
+        end_index = min(last, index + PCD_PUNCH_BATCH);
+        nr = pcd_cow_hole(dev_data, index, end_index, old);
+
+        //Existing user mappings still point at the released pages
+        pcd_unmap_range(dev_data, (loff_t)index << PAGE_SHIFT, (loff_t)(end_index - index) << PAGE_SHIFT);
+        if(!nr)
+            continue;
+
+        mutex_unlock(&dev_data->pcd_lock);
+        synchronize_rcu();
+        for(i = 0; i < nr; i++)
+            put_page(old[i]);
+        //Table pages among them may be unused now
+        schedule_work(&pcd_cow_prune_work);
+        mutex_lock(&dev_data->pcd_lock);
+    }
+
+unlock:
+    mutex_unlock(&dev_data->pcd_lock);
+    mutex_unlock(&dev_data->resize_lock);
+    pcd_wake_value_waiters(dev_data);
+    return ret;
+}
@@ -0,0 +1,20 @@
+#ifndef PCD_COW_H
+#define PCD_COW_H
+
+#include <linux/types.h>
+#include <linux/mm_types.h>
+
+struct pcdev_private_data;
+struct pcd_store;
+
+int pcd_cow_init(void);
+void pcd_cow_exit(void);
+struct page* pcd_cow_lookup(const void *buf, bool *shared);
+bool pcd_cow_pending(struct pcd_store *store, size_t pos, size_t len);
+int pcd_cow_break(struct pcdev_private_data *dev_data, size_t pos, size_t len);
+unsigned long pcd_cow_shared_pages(struct pcdev_private_data *dev_data);
+size_t pcd_cow_resident_bytes(struct pcdev_private_data *dev_data);
+loff_t pcd_cow_seek(struct pcdev_private_data *dev_data, loff_t offset, int whence);
+int pcd_cow_punch(struct pcdev_private_data *dev_data, loff_t pos, loff_t len);
+
+#endif
@@ -0,0 +1,358 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/crc32.h>
+#include <linux/crc32c.h>
+#include <linux/highmem.h>
+
+//scrub_flags bits
+#define PCD_SCRUB_RUNNING 0
+#define PCD_SCRUB_STOP 1
+
+/*Checksum a write above this many bytes of a page from scratch, below it
+folding the change into the old checksum touches fewer bytes*/
+#define PCD_CSUM_INCREMENTAL_MAX (PAGE_SIZE / 2)
+
+static void pcd_integrity_scrub(struct work_struct *work);
+
+void pcd_integrity_init(struct pcdev_private_data *dev_data)
+{
+    INIT_WORK(&dev_data->scrub_work, pcd_integrity_scrub);
+}
+
+void pcd_integrity_exit(struct pcdev_private_data *dev_data)
+{
+    set_bit(PCD_SCRUB_STOP, &dev_data->scrub_flags);
+    cancel_work_sync(&dev_data->scrub_work);
+}
+
+static void pcd_integrity_account(struct pcdev_private_data *dev_data, size_t bytes, u64 ns)
+{
+    unsigned long flags;
+    struct pcd_stats *s = pcd_stats_begin(dev_data->stats, &flags);
+
+    s->csum_bytes += bytes;
+    s->csum_ns += ns;
+    pcd_stats_end(s, flags);
+}
+
+//Fold a change of len bytes at pos from old to new into the checksum of their page
+static void pcd_integrity_fold(struct pcd_store *store, size_t pos, const void *old, const void *new, size_t len)
+{
+    u32 delta = crc32c(0, old, len) ^ crc32c(0, new, len);
+
+    store->csum[PFN_DOWN(pos)] ^= __crc32c_le_shift(delta, PAGE_SIZE - offset_in_page(pos) - len);
+}
+
+/*pcd_store_write that keeps the checksums of the written pages current. CRC32C
+is linear, so for a partial page the old and new bytes are checksummed and the
+difference shifted to its place in the page is folded into the old checksum.
+Called in a pcd_seq write section*/
+void pcd_integrity_write(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, const void *src, size_t len)
+{
+    size_t offset, chunk, bytes = 0;
+    unsigned long index;
+    u64 start, ns = 0;
+    void *vaddr;
+
+    if(!store->csum){
+        pcd_store_write(store, pos, src, len);
+        return;
+    }
+
+    while(len){
+        offset = offset_in_page(pos);
+        chunk = min_t(size_t, len, PAGE_SIZE - offset);
+        index = PFN_DOWN(pos);
+
+        if(chunk > PCD_CSUM_INCREMENTAL_MAX){
+            pcd_store_write(store, pos, src, chunk);
+            start = ktime_get_ns();
+            pcd_store_csum_page(store, index);
+            ns += ktime_get_ns() - start;
+            bytes += PAGE_SIZE;
+        }
+        //pcd_store_write warns about pages that aren't resident and private
+        else if(store->pages[index] && !test_bit(index, store->shared)){
+            start = ktime_get_ns();
+            vaddr = kmap_atomic(store->pages[index]);
+            pcd_integrity_fold(store, pos, vaddr + offset, src, chunk);
+            kunmap_atomic(vaddr);
+            ns += ktime_get_ns() - start;
+            bytes += 2 * chunk;
+            pcd_store_write(store, pos, src, chunk);
+        }
+        else
+            pcd_store_write(store, pos, src, chunk);
+
+        src += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+    pcd_integrity_account(dev_data, bytes, ns);
+}
+
+/*For writers that modify a few bytes in place without pcd_store_write, old
+and new are the contents before and after. The range must not cross a page*/
+void pcd_integrity_patch(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, const void *old, const void *new, size_t len)
+{
+    u64 start;
+
+    if(!store->csum || !len)
+        return;
+
+    start = ktime_get_ns();
+    pcd_integrity_fold(store, pos, old, new, len);
+    pcd_integrity_account(dev_data, 2 * len, ktime_get_ns() - start);
+}
+
+//Recompute the checksums of the pages in [pos, pos + len) after they changed in place
+void pcd_integrity_update(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len)
+{
+    unsigned long i;
+    u64 start;
+
+    if(!store->csum || !len)
+        return;
+
+    start = ktime_get_ns();
+    for(i = PFN_DOWN(pos); i <= PFN_DOWN(pos + len - 1); i++)
+        pcd_store_csum_page(store, i);
+    pcd_integrity_account(dev_data, (PFN_DOWN(pos + len - 1) - PFN_DOWN(pos) + 1) * PAGE_SIZE,
+            ktime_get_ns() - start);
+}
+
+/*Check the pages under [pos, pos + len) against their checksums when reads are
+verified. Holes are skipped, the scrub checks the zero page. Safe under RCU,
+a mismatch only counts once the pcd_seq snapshot turns out to be stable*/
+bool pcd_integrity_verify(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len, unsigned long *bad)
+{
+    struct page *page;
+    unsigned long i;
+    u64 start;
+    void *vaddr;
+    bool ok = true;
+    u32 csum;
+
+    if(!store->csum || !len || !READ_ONCE(dev_data->verify_reads))
+        return true;
+
+    start = ktime_get_ns();
+    for(i = PFN_DOWN(pos); i <= PFN_DOWN(pos + len - 1); i++){
+        page = READ_ONCE(store->pages[i]);
+        if(!page || page == pcdrv_data.zero_page)
+            continue;
+        vaddr = kmap_atomic(page);
+        csum = pcd_store_csum_buf(vaddr);
+        kunmap_atomic(vaddr);
+        if(csum != store->csum[i]){
+            *bad = i;
+            ok = false;
+            break;
+        }
+    }
+    pcd_integrity_account(dev_data, (i - PFN_DOWN(pos)) * PAGE_SIZE, ktime_get_ns() - start);
+
+    return ok;
+}
+
+void pcd_integrity_report(struct pcdev_private_data *dev_data, unsigned long index)
+{
+    pcd_stats_add(dev_data->stats, csum_errors, 1);
+    dev_err_ratelimited(dev_data->device, "Checksum mismatch in page %lu\n", index);
+}
+
+/*Check one page against its checksum. Returns 1 on a mismatch, 0 if it
+matches and -ERANGE past the end of the device*/
+static int pcd_integrity_scrub_page(struct pcdev_private_data *dev_data, unsigned long index, void *buf)
+{
+    struct pcd_store *store;
+    struct page *page;
+    unsigned int seq;
+    u32 expected, actual = 0;
+    void *vaddr;
+    int ret;
+
+retry:
+    rcu_read_lock();
+    do {
+        seq = read_seqcount_begin(&dev_data->pcd_seq);
+        store = rcu_dereference(dev_data->store);
+        if(index >= store->nr_pages){
+            rcu_read_unlock();
+            return -ERANGE;
+        }
+        page = READ_ONCE(store->pages[index]);
+        expected = store->csum[index];
+        if(page == pcdrv_data.zero_page)
+            actual = pcdrv_data.zero_csum;
+        else if(page){
+            vaddr = kmap_atomic(page);
+            actual = pcd_store_csum_buf(vaddr);
+            kunmap_atomic(vaddr);
+        }
+    } while(read_seqcount_retry(&dev_data->pcd_seq, seq));
+    rcu_read_unlock();
+
+    if(page)
+        return actual != expected;
+
+    //Compressed, check the image without bringing the page back
+    mutex_lock(&dev_data->pcd_lock);
+    store = pcd_locked_store(dev_data);
+    if(index < store->nr_pages && store->pages[index]){
+        mutex_unlock(&dev_data->pcd_lock);
+        goto retry;
+    }
+    ret = index < store->nr_pages ? pcd_compress_read(dev_data, index, buf) : -ERANGE;
+    if(!ret)
+        ret = pcd_store_csum_buf(buf) != store->csum[index];
+    else if(ret != -ERANGE)
+        ret = 1;
+    mutex_unlock(&dev_data->pcd_lock);
+
+    return ret;
+}
+
+/*Walk the whole device in the background. Writers are only held up while a
+compressed page is checked, resident pages are checked like lockless reads*/
+static void pcd_integrity_scrub(struct work_struct *work)
+{
+    struct pcdev_private_data *dev_data = container_of(work, struct pcdev_private_data, scrub_work);
+    u64 start = ktime_get_ns();
+    unsigned long index;
+    void *buf, *vaddr;
+    bool zero_ok;
+    int ret;
+
+    WRITE_ONCE(dev_data->scrub_pages, 0);
+    WRITE_ONCE(dev_data->scrub_errors, 0);
+
+    buf = kmalloc(PAGE_SIZE, GFP_KERNEL);
+    if(!buf)
+        goto out;
+
+    //Every hole of every device is the zero page, its checksum is only checked here
+    vaddr = kmap_atomic(pcdrv_data.zero_page);
+    zero_ok = pcd_store_csum_buf(vaddr) == pcdrv_data.zero_csum;
+    kunmap_atomic(vaddr);
+    if(!zero_ok){
+        dev_err(dev_data->device, "Zero page corrupted\n");
+        WRITE_ONCE(dev_data->scrub_errors, 1);
+    }
+
+    for(index = 0; !test_bit(PCD_SCRUB_STOP, &dev_data->scrub_flags); index++){
+        ret = pcd_integrity_scrub_page(dev_data, index, buf);
+        if(ret < 0)
+            break;
+        if(ret){
+            pcd_integrity_report(dev_data, index);
+            WRITE_ONCE(dev_data->scrub_errors, dev_data->scrub_errors + 1);
+        }
+        WRITE_ONCE(dev_data->scrub_pages, index + 1);
+        cond_resched();
+    }
+    kfree(buf);
+
+out:
+    WRITE_ONCE(dev_data->scrub_ns, ktime_get_ns() - start);
+    clear_bit(PCD_SCRUB_RUNNING, &dev_data->scrub_flags);
+}
+
+static ssize_t show_enabled(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%d\n",dev_data->pdata.integrity);
+}
+
+static ssize_t show_verify_reads(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%d\n",READ_ONCE(dev_data->verify_reads));
+}
+
+static ssize_t store_verify_reads(struct device *dev, struct device_attribute *attr, const char* buf, size_t count)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    bool verify;
+    int ret;
+
+    ret = kstrtobool(buf, &verify);
+    if(ret)
+        return ret;
+    if(verify && !dev_data->pdata.integrity)
+        return -EINVAL;
+
+    WRITE_ONCE(dev_data->verify_reads, verify);
+    return count;
+}
+
+static ssize_t show_scrub(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%s\n",test_bit(PCD_SCRUB_RUNNING, &dev_data->scrub_flags) ? "running" : "idle");
+}
+
+//1 starts a scrub in the background, 0 stops a running one
+static ssize_t store_scrub(struct device *dev, struct device_attribute *attr, const char* buf, size_t count)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    bool start;
+    int ret;
+
+    ret = kstrtobool(buf, &start);
+    if(ret)
+        return ret;
+    if(!dev_data->pdata.integrity)
+        return -EINVAL;
+
+    if(!start){
+        set_bit(PCD_SCRUB_STOP, &dev_data->scrub_flags);
+        return count;
+    }
+
+    if(test_and_set_bit(PCD_SCRUB_RUNNING, &dev_data->scrub_flags))
+        return -EBUSY;
+    clear_bit(PCD_SCRUB_STOP, &dev_data->scrub_flags);
+    queue_work(system_unbound_wq, &dev_data->scrub_work);
+    return count;
+}
+
+static ssize_t show_scrub_pages(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%lu\n",READ_ONCE(dev_data->scrub_pages));
+}
+
+static ssize_t show_scrub_errors(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%lu\n",READ_ONCE(dev_data->scrub_errors));
+}
+
+static ssize_t show_scrub_time_us(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%llu\n",div_u64(READ_ONCE(dev_data->scrub_ns), NSEC_PER_USEC));
+}
+
+static DEVICE_ATTR(enabled, S_IRUGO, show_enabled, NULL);
+static DEVICE_ATTR(verify_reads, S_IRUGO | S_IWUSR, show_verify_reads, store_verify_reads);
+static DEVICE_ATTR(scrub, S_IRUGO | S_IWUSR, show_scrub, store_scrub);
+static DEVICE_ATTR(scrub_pages, S_IRUGO, show_scrub_pages, NULL);
+static DEVICE_ATTR(scrub_errors, S_IRUGO, show_scrub_errors, NULL);
+static DEVICE_ATTR(scrub_time_us, S_IRUGO, show_scrub_time_us, NULL);
+
+struct attribute* pcd_integrity_attrs[] = {
+    &dev_attr_enabled.attr,
+    &dev_attr_verify_reads.attr,
+    &dev_attr_scrub.attr,
+    &dev_attr_scrub_pages.attr,
+    &dev_attr_scrub_errors.attr,
+    &dev_attr_scrub_time_us.attr,
+    NULL
+};
+
+//Shows up as the integrity/ directory of each pcdev, checksum costs are under stats/
+struct attribute_group pcd_integrity_attr_group = {
+    .name = "integrity",
+    .attrs = pcd_integrity_attrs
+};
@@ -0,0 +1,20 @@
+#ifndef PCD_INTEGRITY_H
+#define PCD_INTEGRITY_H
+
+#include <linux/types.h>
+#include <linux/sysfs.h>
+
+struct pcdev_private_data;
+struct pcd_store;
+
+void pcd_integrity_init(struct pcdev_private_data *dev_data);
+void pcd_integrity_exit(struct pcdev_private_data *dev_data);
+void pcd_integrity_write(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, const void *src, size_t len);
+void pcd_integrity_patch(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, const void *old, const void *new, size_t len);
+void pcd_integrity_update(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len);
+bool pcd_integrity_verify(struct pcdev_private_data *dev_data, struct pcd_store *store, size_t pos, size_t len, unsigned long *bad);
+void pcd_integrity_report(struct pcdev_private_data *dev_data, unsigned long index);
+
+extern struct attribute_group pcd_integrity_attr_group;
+
+#endif
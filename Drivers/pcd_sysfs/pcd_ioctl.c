@@ -0,0 +1,428 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_syscalls.h"
+#include "pcd_ioctl.h"
+#include <linux/highmem.h>
+
+static int pcd_batch_check_vec(struct file *filp, struct pcd_io_vec *vec)
+{
+    if (vec->op == PCD_OP_READ)
+        return (filp->f_mode & FMODE_READ) ? 0 : -EBADF;
+    if (vec->op == PCD_OP_WRITE)
+        return (filp->f_mode & FMODE_WRITE) ? 0 : -EBADF;
+    return -EINVAL;
+}
+
+//Room an entry takes in the staging buffer, entries rejected up front take none
+static size_t pcd_batch_span(struct file *filp, struct pcd_io_vec *vec)
+{
+    return pcd_batch_check_vec(filp, vec) ? 0 : vec->len;
+}
+
+/*User buffers are staged through one kernel buffer so that the entries run
+back to back under pcd_lock without faulting. Write payloads are copied in
+before taking the lock and read results copied out after dropping it*/
+static long pcd_ioctl_batch(struct file *filp, struct pcd_io_batch __user *ubatch)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    struct pcd_io_batch batch;
+    struct pcd_io_vec *vecs, *vec;
+    struct pcd_store *store;
+    size_t total = 0, len;
+    bool has_writes = false;
+    unsigned long bad;
+    u64 start = ktime_get_ns(), latency;
+    char *kbuf, *p;
+    long ret = 0;
+    u32 i;
+
+    if (copy_from_user(&batch, ubatch, sizeof(batch)))
+        return -EFAULT;
+
+    if (!batch.count || batch.count > PCD_BATCH_MAX_VECS || batch.flags)
+        return -EINVAL;
+
+    //FIFO and broadcast devices have no offsets to address
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        return -EINVAL;
+
+    vecs = memdup_user(u64_to_user_ptr(batch.vecs), array_size(batch.count, sizeof(*vecs)));
+    if (IS_ERR(vecs))
+        return PTR_ERR(vecs);
+
+    /*Lengths are checked one by one so the sum stays far below SIZE_MAX on
+    32 bit, a wrapped total would undersize kbuf*/
+    for (i = 0; i < batch.count; i++){
+        vec = &vecs[i];
+        vec->result = pcd_batch_check_vec(filp, vec);
+        if (vec->len > PCD_BATCH_MAX_BYTES){
+            ret = -E2BIG;
+            goto free_vecs;
+        }
+        total += pcd_batch_span(filp, vec);
+        if (total > PCD_BATCH_MAX_BYTES){
+            ret = -E2BIG;
+            goto free_vecs;
+        }
+        has_writes |= vec->op == PCD_OP_WRITE;
+    }
+
+    kbuf = kvmalloc(total, GFP_KERNEL);
+    if (!kbuf){
+        ret = -ENOMEM;
+        goto free_vecs;
+    }
+
+    for (i = 0, p = kbuf; i < batch.count; p += pcd_batch_span(filp, &vecs[i]), i++){
+        vec = &vecs[i];
+        if (!vec->result && vec->op == PCD_OP_WRITE &&
+                copy_from_user(p, u64_to_user_ptr(vec->buf), vec->len))
+            vec->result = -EFAULT;
+    }
+
+    if (mutex_lock_interruptible(&pcdev_data->pcd_lock)){
+        ret = -ERESTARTSYS;
+        goto free_buf;
+    }
+    store = pcd_locked_store(pcdev_data);
+
+    //Decompression and copying shared pages allocate, so they happen before the seqcount section
+    for (i = 0; i < batch.count; i++){
+        vec = &vecs[i];
+        len = pcd_clamp_count(vec->offset, vec->len, store->size);
+        if (vec->result || !len)
+            continue;
+        vec->result = pcd_compress_ensure(pcdev_data, vec->offset, len);
+        if (!vec->result && vec->op == PCD_OP_WRITE)
+            vec->result = pcd_cow_break(pcdev_data, vec->offset, len);
+    }
+
+    //Lockless readers only need to retry if the batch modifies the device
+    if (has_writes)
+        write_seqcount_begin(&pcdev_data->pcd_seq);
+
+    for (i = 0, p = kbuf; i < batch.count; p += pcd_batch_span(filp, &vecs[i]), i++){
+        vec = &vecs[i];
+        if (vec->result)
+            continue;
+
+        //Same clamping as read_iter/write_iter
+        len = pcd_clamp_count(vec->offset, vec->len, store->size);
+        if (!len){
+            vec->result = (vec->op == PCD_OP_READ || !vec->len) ? 0 : -ENOMEM;
+            continue;
+        }
+
+        if (vec->op == PCD_OP_READ){
+            if (!pcd_integrity_verify(pcdev_data, store, vec->offset, len, &bad)){
+                pcd_integrity_report(pcdev_data, bad);
+                vec->result = -EIO;
+                continue;
+            }
+            pcd_store_read(store, vec->offset, p, len);
+        }
+        else {
+            pcd_integrity_write(pcdev_data, store, vec->offset, p, len);
+            pcd_backing_mark_dirty(pcdev_data, vec->offset, len);
+        }
+        pcd_compress_touch(pcdev_data, store, vec->offset, len);
+        vec->result = len;
+    }
+
+    if (has_writes)
+        write_seqcount_end(&pcdev_data->pcd_seq);
+    mutex_unlock(&pcdev_data->pcd_lock);
+    if (has_writes)
+        pcd_wake_value_waiters(pcdev_data);
+
+    latency = div_u64(ktime_get_ns() - start, batch.count);
+    for (i = 0, p = kbuf; i < batch.count; p += pcd_batch_span(filp, &vecs[i]), i++){
+        vec = &vecs[i];
+        if (vec->op == PCD_OP_READ){
+            if (vec->result > 0 && copy_to_user(u64_to_user_ptr(vec->buf), p, vec->result))
+                vec->result = -EFAULT;
+            pcd_stats_account_read(pcdev_data, vec->len, vec->result, latency);
+        }
+        else if (vec->op == PCD_OP_WRITE)
+            pcd_stats_account_write(pcdev_data, vec->len, vec->result, latency);
+    }
+
+    if (copy_to_user(u64_to_user_ptr(batch.vecs), vecs, array_size(batch.count, sizeof(*vecs))))
+        ret = -EFAULT;
+
+free_buf:
+    kvfree(kbuf);
+free_vecs:
+    kfree(vecs);
+    return ret;
+}
+
+static long pcd_ioctl_punch_hole(struct file *filp, struct pcd_range __user *urange)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    struct pcd_range range;
+
+    if (!(filp->f_mode & FMODE_WRITE))
+        return -EBADF;
+
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        return -EINVAL;
+
+    if (copy_from_user(&range, urange, sizeof(range)))
+        return -EFAULT;
+
+    if (range.offset > LLONG_MAX || range.len > LLONG_MAX)
+        return -EINVAL;
+
+    return pcd_cow_punch(pcdev_data, range.offset, range.len);
+}
+
+//Words never cross a page, so one kmap covers them
+static int pcd_word_check(u64 offset, u32 size)
+{
+    if (size != sizeof(u32) && size != sizeof(u64))
+        return -EINVAL;
+    if (offset > LLONG_MAX || !IS_ALIGNED(offset, size))
+        return -EINVAL;
+    return 0;
+}
+
+//A word as the device holds it, in host byte order
+union pcd_word
+{
+    u32 w32;
+    u64 w64;
+};
+
+static u64 pcd_word_load(void *ptr, u32 size)
+{
+    return size == sizeof(u32) ? READ_ONCE(*(u32 *)ptr) : READ_ONCE(*(u64 *)ptr);
+}
+
+static void *pcd_word_store(union pcd_word *word, u64 val, u32 size)
+{
+    if (size == sizeof(u32))
+        word->w32 = val;
+    else
+        word->w64 = val;
+    return word;
+}
+
+/*Apply op with a compare-and-swap loop, so the update is also atomic against
+processes using atomics on an mmap of the same page. Returns the old value,
+*new the value left in the word*/
+static u64 pcd_word_apply(void *ptr, struct pcd_atomic *a, u64 *new)
+{
+    u64 mask = a->size == sizeof(u32) ? U32_MAX : U64_MAX;
+    u64 old, val, seen;
+
+    old = pcd_word_load(ptr, a->size);
+    for (;;){
+        if (a->op == PCD_ATOMIC_CAS && old != (a->expected & mask)){
+            *new = old;
+            return old;
+        }
+        val = (a->op == PCD_ATOMIC_ADD ? old + a->value : a->value) & mask;
+
+        if (a->size == sizeof(u32))
+            seen = cmpxchg((u32 *)ptr, (u32)old, (u32)val);
+        else
+            seen = cmpxchg64((u64 *)ptr, old, val);
+        if (seen == old)
+            break;
+        old = seen;
+    }
+
+    *new = val;
+    return old;
+}
+
+/*Writes serialize on pcd_lock like every other write, the seqcount section
+keeps lockless readers from seeing the word half updated*/
+static long pcd_ioctl_atomic(struct file *filp, struct pcd_atomic __user *uatomic)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    struct pcd_store *store;
+    struct pcd_atomic a;
+    union pcd_word before, after;
+    u64 old = 0, new = 0;
+    void *vaddr;
+    long ret;
+
+    if ((filp->f_mode & (FMODE_READ | FMODE_WRITE)) != (FMODE_READ | FMODE_WRITE))
+        return -EBADF;
+
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        return -EINVAL;
+
+    if (copy_from_user(&a, uatomic, sizeof(a)))
+        return -EFAULT;
+
+    ret = pcd_word_check(a.offset, a.size);
+    if (ret)
+        return ret;
+    if (a.op > PCD_ATOMIC_XCHG)
+        return -EINVAL;
+
+    if (mutex_lock_interruptible(&pcdev_data->pcd_lock))
+        return -ERESTARTSYS;
+    store = pcd_locked_store(pcdev_data);
+
+    if (pcd_clamp_count(a.offset, a.size, store->size) != a.size){
+        ret = -EINVAL;
+        goto unlock;
+    }
+    ret = pcd_compress_ensure(pcdev_data, a.offset, a.size);
+    if (!ret)
+        ret = pcd_cow_break(pcdev_data, a.offset, a.size);
+    if (ret)
+        goto unlock;
+
+    write_seqcount_begin(&pcdev_data->pcd_seq);
+    vaddr = kmap_atomic(store->pages[PFN_DOWN(a.offset)]);
+    old = pcd_word_apply(vaddr + offset_in_page(a.offset), &a, &new);
+    kunmap_atomic(vaddr);
+    if (new != old)
+        pcd_integrity_patch(pcdev_data, store, a.offset, pcd_word_store(&before, old, a.size),
+                pcd_word_store(&after, new, a.size), a.size);
+    write_seqcount_end(&pcdev_data->pcd_seq);
+
+    pcd_compress_touch(pcdev_data, store, a.offset, a.size);
+    if (new != old)
+        pcd_backing_mark_dirty(pcdev_data, a.offset, a.size);
+
+unlock:
+    mutex_unlock(&pcdev_data->pcd_lock);
+    if (ret)
+        return ret;
+
+    if (new != old)
+        pcd_wake_value_waiters(pcdev_data);
+
+    a.result = old;
+    if (put_user(a.result, &uatomic->result))
+        return -EFAULT;
+    return 0;
+}
+
+/*Current value of the word for a sleeper, without sleeping. False if the
+word is compressed or past the end of the device, the waiter then rechecks
+through pcd_data_read*/
+static bool pcd_word_peek(struct pcdev_private_data *pcdev_data, u64 offset, u32 size, u64 *val)
+{
+    struct pcd_store *store;
+    struct page *page;
+    unsigned int seq;
+    void *vaddr;
+
+    rcu_read_lock();
+    do {
+        seq = read_seqcount_begin(&pcdev_data->pcd_seq);
+        store = rcu_dereference(pcdev_data->store);
+        page = NULL;
+        if (pcd_clamp_count(offset, size, store->size) == size)
+            page = READ_ONCE(store->pages[PFN_DOWN(offset)]);
+        if (page){
+            vaddr = kmap_atomic(page);
+            *val = pcd_word_load(vaddr + offset_in_page(offset), size);
+            kunmap_atomic(vaddr);
+        }
+    } while (read_seqcount_retry(&pcdev_data->pcd_seq, seq));
+    rcu_read_unlock();
+
+    return page != NULL;
+}
+
+static bool pcd_word_changed(struct pcdev_private_data *pcdev_data, struct pcd_wait *w)
+{
+    u64 val;
+
+    return !pcd_word_peek(pcdev_data, w->offset, w->size, &val) || val != w->value;
+}
+
+//0 once the word differs from value, -ETIMEDOUT when the timeout expires first
+static long pcd_ioctl_wait(struct file *filp, struct pcd_wait __user *uwait)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    struct pcd_wait w;
+    union pcd_word word;
+    ktime_t deadline = 0, left;
+    ssize_t len;
+    long ret;
+    u64 val;
+
+    if (!(filp->f_mode & FMODE_READ))
+        return -EBADF;
+
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        return -EINVAL;
+
+    if (copy_from_user(&w, uwait, sizeof(w)))
+        return -EFAULT;
+
+    ret = pcd_word_check(w.offset, w.size);
+    if (ret)
+        return ret;
+    if (w.flags)
+        return -EINVAL;
+    w.value &= w.size == sizeof(u32) ? U32_MAX : U64_MAX;
+
+    if (w.timeout_ns >= 0)
+        deadline = ktime_add_ns(ktime_get(), w.timeout_ns);
+
+    for (;;){
+        //Brings the page back if it was compressed, and catches a shrink below the word
+        len = pcd_data_read(pcdev_data, w.offset, &word, w.size, false);
+        if (len < 0)
+            return len;
+        if (len != w.size)
+            return -EINVAL;
+        val = w.size == sizeof(u32) ? word.w32 : word.w64;
+        if (val != w.value)
+            break;
+
+        if (w.timeout_ns < 0)
+            ret = wait_event_interruptible(pcdev_data->value_wq, pcd_word_changed(pcdev_data, &w));
+        else {
+            left = ktime_sub(deadline, ktime_get());
+            if (left <= 0)
+                return -ETIMEDOUT;
+            ret = wait_event_interruptible_hrtimeout(pcdev_data->value_wq, pcd_word_changed(pcdev_data, &w), left);
+        }
+        if (ret == -ETIME)
+            return -ETIMEDOUT;
+        if (ret)
+            return ret;
+    }
+
+    w.result = val;
+    if (put_user(w.result, &uwait->result))
+        return -EFAULT;
+    return 0;
+}
+
+long pcd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+    switch (cmd)
+    {
+    case PCD_IOC_BATCH:
+        return pcd_ioctl_batch(filp, (struct pcd_io_batch __user *)arg);
+
+    case PCD_IOC_PUNCH_HOLE:
+        return pcd_ioctl_punch_hole(filp, (struct pcd_range __user *)arg);
+
+    case PCD_IOC_ATOMIC:
+        return pcd_ioctl_atomic(filp, (struct pcd_atomic __user *)arg);
+
+    case PCD_IOC_WAIT:
+        return pcd_ioctl_wait(filp, (struct pcd_wait __user *)arg);
+
+    case PCD_IOC_WAKE:
+        pcd_wake_value_waiters(pcd_file_dev(filp));
+        if (pcd_file_dev(filp)->pdata.mode == PCD_MODE_SHM)
+            pcd_ring_wake(pcd_file_dev(filp));
+        return 0;
+
+    default:
+        return -ENOTTY;
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef PCD_IOCTL_H
+#define PCD_IOCTL_H
+
+/*ioctl interface of the pcd devices, shared between the driver and user space.
+Only fixed size types so the same layout works for 32 and 64 bit callers*/
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+#define PCD_OP_READ 0
+#define PCD_OP_WRITE 1
+
+//Limits of a single batch
+#define PCD_BATCH_MAX_VECS 1024
+#define PCD_BATCH_MAX_BYTES (1 << 20)
+
+struct pcd_io_vec
+{
+    __u32 op;       //PCD_OP_READ or PCD_OP_WRITE
+    __u32 len;      //Bytes to transfer
+    __u64 offset;   //Device offset, the file position is not used or updated
+    __u64 buf;      //User buffer address
+    __s64 result;   //Out: bytes transferred or -errno for this entry
+};
+
+struct pcd_io_batch
+{
+    __u64 vecs;     //Address of an array of struct pcd_io_vec
+    __u32 count;    //Number of entries in vecs
+    __u32 flags;    //Must be 0
+};
+
+struct pcd_range
+{
+    __u64 offset;
+    __u64 len;
+};
+
+#define PCD_ATOMIC_CAS 0     //Store value if the word equals expected
+#define PCD_ATOMIC_ADD 1     //Add value to the word
+#define PCD_ATOMIC_XCHG 2    //Store value unconditionally
+
+//Atomic operation on a naturally aligned 4 or 8 byte word of the device
+struct pcd_atomic
+{
+    __u64 offset;
+    __u32 op;       //PCD_ATOMIC_*
+    __u32 size;     //4 or 8
+    __u64 value;
+    __u64 expected; //PCD_ATOMIC_CAS only
+    __u64 result;   //Out: value of the word before the operation
+};
+
+//Sleep until the word at offset no longer holds value, like FUTEX_WAIT
+struct pcd_wait
+{
+    __u64 offset;
+    __u32 size;         //4 or 8, naturally aligned
+    __u32 flags;        //Must be 0
+    __u64 value;
+    __s64 timeout_ns;   //Relative, negative waits forever
+    __u64 result;       //Out: value of the word that ended the wait
+};
+
+//Set in pcd_bcast_hdr.flags when the read buffer was too small for the whole payload
+#define PCD_BCAST_TRUNCATED 0x1
+
+/*Every read() of a broadcast device returns one record, this header followed
+by the payload. Not an ioctl argument, kept here with the rest of the
+user space interface*/
+struct pcd_bcast_hdr
+{
+    __u64 seq;      //Sequence number of the record, counts up from 0 per device
+    __u64 missed;   //Records overwritten before this reader got to them, since its last read
+    __u32 len;      //Payload length as written, the bytes returned may be fewer
+    __u32 flags;    //PCD_BCAST_*
+};
+
+/*Control page of a shared memory ring device, mapped at offset 0. The data
+area of size bytes follows at data_offset and is mapped twice back to back,
+so a transfer that wraps is still one contiguous copy. head and tail count
+bytes and wrap at 2^32, the ring holds head - tail bytes starting at
+tail % size. Each side owns one cache line: the producer only stores head
+and producer_waiting, the consumer only tail and consumer_waiting.
+
+The producer writes the data, then publishes head with a release store. The
+consumer reads head with an acquire load, reads the data, then publishes tail
+with a release store. No syscall is needed while the ring is neither empty
+nor full. To sleep, a side sets its _waiting flag, issues a full barrier,
+checks the ring again and only then poll()s for EPOLLIN (consumer) or
+EPOLLOUT (producer). After publishing, the other side issues a full barrier
+and, if the peer's flag is set, clears it and calls PCD_IOC_WAKE*/
+struct pcd_ring_ctrl
+{
+    __u32 size;             //Bytes in the data area, a power of two, set by the driver
+    __u32 data_offset;      //mmap offset of the data area, set by the driver
+    __u8 pad0[56];
+    __u32 head;             //Producer index
+    __u32 producer_waiting;
+    __u8 pad1[56];
+    __u32 tail;             //Consumer index
+    __u32 consumer_waiting;
+    __u8 pad2[56];
+};
+
+#define PCD_IOC_MAGIC 'p'
+
+//Run all entries in order under a single acquisition of the device lock
+#define PCD_IOC_BATCH _IOWR(PCD_IOC_MAGIC, 1, struct pcd_io_batch)
+/*Release the memory behind a range, it reads as zeros afterwards. The char
+device's stand-in for fallocate(FALLOC_FL_PUNCH_HOLE), which only reaches
+regular files and block devices*/
+#define PCD_IOC_PUNCH_HOLE _IOW(PCD_IOC_MAGIC, 2, struct pcd_range)
+/*Word operations for processes using a device as shared memory. Every write
+to the device wakes PCD_IOC_WAIT sleepers, stores through an mmap don't, so
+mapping users follow theirs with PCD_IOC_WAKE*/
+#define PCD_IOC_ATOMIC _IOWR(PCD_IOC_MAGIC, 3, struct pcd_atomic)
+#define PCD_IOC_WAIT _IOWR(PCD_IOC_MAGIC, 4, struct pcd_wait)
+//Also wakes the poll() sleepers of a shared memory ring device
+#define PCD_IOC_WAKE _IO(PCD_IOC_MAGIC, 5)
+
+#endif
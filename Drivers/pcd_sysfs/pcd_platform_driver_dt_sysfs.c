@@ -1,5 +1,7 @@
 #include "pcd_platform_driver_dt_sysfs.h"
 #include "pcd_syscalls.h"
+#include "pcd_trace.h"
+#include "pcd_configfs.h"
 
 struct device_config pcdev_config[] = {
     {
@@ -20,15 +22,34 @@ struct device_config pcdev_config[] = {
     }
 };
 
-struct pcdrv_private_data pcdrv_data;
+struct pcdrv_private_data pcdrv_data = {
+    .minor_ida = IDA_INIT(pcdrv_data.minor_ida),
+    .devices = XARRAY_INIT(pcdrv_data.devices, 0),
+    .max_devices = MAX_DEVICES
+};
+
+module_param_named(max_devices, pcdrv_data.max_devices, uint, 0444);
+MODULE_PARM_DESC(max_devices, "Maximum number of pcd devices, minors are reserved for all of them at load");
+
+//Devices without an org,backing-file property are backed by <backing_dir>/<serial>.img when set
+static char *backing_dir;
+module_param(backing_dir, charp, 0444);
+MODULE_PARM_DESC(backing_dir, "Directory holding backing files of pcd devices");
 
 struct file_operations pcd_fops=
 {
 	.open = pcd_open,
-	.write = pcd_write,
-	.read = pcd_read,
+	.write_iter = pcd_write_iter,
+	.read_iter = pcd_read_iter,
 	.llseek = pcd_lseek,
 	.release = pcd_release,
+	.mmap = pcd_mmap,
+	.unlocked_ioctl = pcd_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.poll = pcd_poll,
+	//splice/sendfile/tee move data between pipes and the store through read_iter/write_iter
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
 	.owner = THIS_MODULE
 };
 
@@ -52,33 +73,200 @@ ssize_t show_serial_num(struct device *dev, struct device_attribute *attr, char*
     return ret;
 }
 
+//Names of the PCD_MODE_* values, as in the org,mode property and the mode attribute
+static const char * const pcd_mode_names[] = {
+    [PCD_MODE_RANDOM] = "random",
+    [PCD_MODE_FIFO] = "fifo",
+    [PCD_MODE_BROADCAST] = "broadcast",
+    [PCD_MODE_SHM] = "shm"
+};
+
+const char* pcd_mode_name(int mode)
+{
+    return pcd_mode_names[mode];
+}
+
+//PCD_MODE_* for a mode name, a trailing newline is ignored
+int pcd_mode_from_name(const char *name)
+{
+    return sysfs_match_string(pcd_mode_names, name);
+}
+
+//FIFO contents are linearized into a fresh store since ring offsets depend on the size
+static void pcd_resize_fifo(struct pcdev_private_data *dev_data, struct pcd_store *new_store, size_t new_size)
+{
+    struct pcd_store *old_store = pcd_locked_store(dev_data);
+    size_t len = min_t(size_t, dev_data->fifo_len, new_size);
+    size_t first = min_t(size_t, len, old_store->size - dev_data->fifo_head);
+
+    pcd_store_copy(new_store, 0, old_store, dev_data->fifo_head, first);
+    pcd_store_copy(new_store, first, old_store, 0, len - first);
+    dev_data->fifo_head = 0;
+    dev_data->fifo_len = len;
+}
+
+/*Resizes build the new store off to the side under resize_lock. No page is
+allocated or copied, writers only wait for the page pointers to be taken over
+and readers never stall. In-flight readers finish on the old store, which is
+freed after an RCU grace period. Shared by the max_size attribute and DT
+property updates*/
+static int pcd_resize_check(struct pcdev_private_data *dev_data, long result)
+{
+    if(result <= 0 || result > INT_MAX)
+        return -EINVAL;
+
+    if(dev_data->pdata.mode == PCD_MODE_SHM && !pcd_ring_size_ok(result))
+        return -EINVAL;
+
+    return 0;
+}
+
+static int pcd_resize(struct pcdev_private_data *dev_data, long result)
+{
+    int ret;
+    bool ring;
+    unsigned long nr_shared;
+    unsigned long *new_map, *old_map;
+    struct pcd_store *new_store, *old_store;
+
+    ret = pcd_resize_check(dev_data, result);
+    if(ret)
+        return ret;
+
+    ring = dev_data->pdata.mode != PCD_MODE_RANDOM;
+
+    mutex_lock(&dev_data->resize_lock);
+    old_store = rcu_dereference_protected(dev_data->store, lockdep_is_held(&dev_data->resize_lock));
+
+    new_map = pcd_backing_alloc_map(dev_data, result);
+    if(dev_data->backing_file && !new_map){
+        mutex_unlock(&dev_data->resize_lock);
+        return -ENOMEM;
+    }
+
+    if(ring){
+        //A ring starts fresh, ring writes go straight to the pages so they are never shared
+        new_store = pcd_store_alloc(result, false);
+        if(!new_store || pcd_store_unshare(new_store)){
+            mutex_unlock(&dev_data->resize_lock);
+            pcd_store_free(new_store);
+            bitmap_free(new_map);
+            return -ENOMEM;
+        }
+        mutex_lock(&dev_data->pcd_lock);
+    }
+    else {
+        /*A random access store shares the pages that stay in range. Writers swap
+        slots of the old store under pcd_lock, so they are copied under it too.
+        The new last page gets its tail cleared below, it has to be resident and
+        private for that*/
+        mutex_lock(&dev_data->pcd_lock);
+        ret = 0;
+        if(result < old_store->size){
+            ret = pcd_compress_ensure(dev_data, result, 1);
+            if(!ret)
+                ret = pcd_cow_break(dev_data, result, 1);
+        }
+        new_store = ret ? NULL : pcd_store_resize(old_store, result);
+        if(!new_store){
+            mutex_unlock(&dev_data->pcd_lock);
+            mutex_unlock(&dev_data->resize_lock);
+            bitmap_free(new_map);
+            return ret ? ret : -ENOMEM;
+        }
+    }
+    nr_shared = ring ? 0 : min(old_store->nr_pages, new_store->nr_pages);
+
+    if(dev_data->pdata.mode == PCD_MODE_FIFO)
+        pcd_resize_fifo(dev_data, new_store, result);
+
+    write_seqcount_begin(&dev_data->pcd_seq);
+    rcu_assign_pointer(dev_data->store, new_store);
+    dev_data->pdata.size = result;
+    //Broadcast records are not carried over, readers see them as missed
+    if(dev_data->pdata.mode == PCD_MODE_BROADCAST)
+        pcd_bcast_reset(dev_data);
+    else if(dev_data->pdata.mode == PCD_MODE_SHM)
+        pcd_ring_reset(dev_data);
+    else if(!ring)
+        pcd_store_zero_tail(new_store, result);
+    write_seqcount_end(&dev_data->pcd_seq);
+    pcd_compress_discard(dev_data, new_store->nr_pages, ULONG_MAX);
+    old_map = pcd_backing_swap_map(dev_data, new_map, result);
+    mutex_unlock(&dev_data->pcd_lock);
+    bitmap_free(old_map);
+
+    if(!ring)
+        pcd_blk_resize(dev_data, result);
+
+    //Drop user mappings of pages that are no longer part of the device
+    pcd_unmap_range(dev_data, ring ? 0 : PAGE_ALIGN(result), 0);
+    mutex_unlock(&dev_data->resize_lock);
+
+    pcd_store_retire(old_store, nr_shared);
+
+    //Blocked producers may have room now, word waiters may be past the end
+    if(ring)
+        wake_up_interruptible_poll(&dev_data->fifo_wq, EPOLLOUT | EPOLLWRNORM);
+    else
+        pcd_wake_value_waiters(dev_data);
+    return 0;
+}
+
 ssize_t store_max_size(struct device *dev, struct device_attribute* attr, const char* buf, size_t count)
 {
     long result;
     int ret;
     struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
 
-    mutex_lock(&dev_data->pcd_lock);
     //kernel method to convert string to long
     ret = kstrtol(buf, 0, &result);
     if(ret)
         return ret;
-    
-    dev_data->pdata.size = result;
-    //Reallocate memory for buffer since there's a change of size
-    dev_data->buffer = krealloc(dev_data->buffer, dev_data->pdata.size, GFP_KERNEL);
 
-    mutex_unlock(&dev_data->pcd_lock);
-    return count;
+    ret = pcd_resize(dev_data, result);
+    return ret ? ret : count;
+}
+
+ssize_t show_shared_pages(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%lu\n",pcd_cow_shared_pages(dev_data));
+}
+
+ssize_t show_resident_bytes(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%zu\n",pcd_cow_resident_bytes(dev_data));
+}
+
+ssize_t show_probe_time_us(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%llu\n",div_u64(READ_ONCE(dev_data->probe_ns), NSEC_PER_USEC));
 }
 
-//Create 2 vars of struct device attribute
+ssize_t show_mode(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return sprintf(buf,"%s\n",pcd_mode_name(dev_data->pdata.mode));
+}
+
+//Create vars of struct device attribute
 static DEVICE_ATTR(max_size, S_IRUGO | S_IWUSR, show_max_size, store_max_size);
 static DEVICE_ATTR(serial_num, S_IRUGO, show_serial_num, NULL);
+static DEVICE_ATTR(mode, S_IRUGO, show_mode, NULL);
+static DEVICE_ATTR(shared_pages, S_IRUGO, show_shared_pages, NULL);
+static DEVICE_ATTR(resident_bytes, S_IRUGO, show_resident_bytes, NULL);
+static DEVICE_ATTR(probe_time_us, S_IRUGO, show_probe_time_us, NULL);
 
 struct attribute* pcd_attrs[] = {
     &dev_attr_max_size.attr,
     &dev_attr_serial_num.attr,
+    &dev_attr_mode.attr,
+    &dev_attr_shared_pages.attr,
+    &dev_attr_resident_bytes.attr,
+    &dev_attr_probe_time_us.attr,
     NULL
 };
 
@@ -86,23 +274,60 @@ struct attribute_group pcd_attr_group = {
     .attrs = pcd_attrs
 };
 
-int pcd_sysfs_create_files(struct device* pcd_dev)
+/*Last reference gone: remove has run and no file, and so no mapping, is left.
+Write-back and the background workers go first, they read the store*/
+static void pcd_dev_release(struct kref *ref)
 {
-#if 0
-    int ret;
-    ret = sysfs_create_file(&pcd_dev->kobj, &dev_attr_max_size.attr);
-    if(ret)
-        return ret;
+    struct pcdev_private_data *dev_data = container_of(ref, struct pcdev_private_data, ref);
+
+    pcd_backing_exit(dev_data);
+    pcd_integrity_exit(dev_data);
+    pcd_compress_exit(dev_data);
+    pcd_store_free(rcu_dereference_protected(dev_data->store, 1));
+    free_percpu(dev_data->stats);
+    if(dev_data->ring_ctrl)
+        free_page((unsigned long)dev_data->ring_ctrl);
+    if(dev_data->map_inode)
+        iput(dev_data->map_inode);
+    put_device(dev_data->device);
+    kfree(dev_data->pdata.serial_number);
+    kfree(dev_data);
+}
 
-    return sysfs_create_file(&pcd_dev->kobj, &dev_attr_serial_num.attr);
-#endif
-    return sysfs_create_group(&pcd_dev->kobj, &pcd_attr_group);
+//Device of an open minor, NULL once remove has unpublished it
+struct pcdev_private_data* pcd_dev_get(unsigned int minor)
+{
+    struct pcdev_private_data *dev_data;
+
+    xa_lock(&pcdrv_data.devices);
+    dev_data = xa_load(&pcdrv_data.devices, minor);
+    if(dev_data)
+        kref_get(&dev_data->ref);
+    xa_unlock(&pcdrv_data.devices);
+
+    return dev_data;
+}
+
+void pcd_dev_put(struct pcdev_private_data *dev_data)
+{
+    kref_put(&dev_data->ref, pcd_dev_release);
 }
 
+//Created along with the device file, before its uevent goes out
+const struct attribute_group* pcd_attr_groups[] = {
+    &pcd_attr_group,
+    &pcd_stats_attr_group,
+    &pcd_compress_attr_group,
+    &pcd_integrity_attr_group,
+    NULL
+};
+
 static struct pcdev_platform_data* pcdev_get_pltdata_from_dt(struct device *dev)
 {
     struct device_node *dev_node = dev->of_node;
     struct pcdev_platform_data *pdata;
+    const char *mode;
+    int ret;
     
     //When probe was called because of device setup than a tree
     if(!dev_node)
@@ -129,20 +354,42 @@ static struct pcdev_platform_data* pcdev_get_pltdata_from_dt(struct device *dev)
         return ERR_PTR(-EINVAL);
     }
 
+    //Optional backing file, the driver wide backing_dir is used as fallback
+    if(of_property_read_string(dev_node, "org,backing-file", &pdata->backing_file) && backing_dir)
+        pdata->backing_file = devm_kasprintf(dev, GFP_KERNEL, "%s/%s.img", backing_dir, pdata->serial_number);
+
+    //Optional property, devices without it are random access buffers
+    pdata->mode = PCD_MODE_RANDOM;
+    if(!of_property_read_string(dev_node, "org,mode", &mode)){
+        ret = pcd_mode_from_name(mode);
+        if(ret < 0){
+            dev_info(dev, "Invalid mode property");
+            return ERR_PTR(-EINVAL);
+        }
+        pdata->mode = ret;
+    }
+
+    //Optional property, cold page compression stays off without it
+    of_property_read_u32(dev_node, "org,compress-interval-ms", &pdata->compress_interval_ms);
+
+    //Optional property, keeps a CRC32C per page
+    pdata->integrity = of_property_read_bool(dev_node, "org,integrity");
+
     return pdata;
 }
 
-//Called when matching device is found
-int pcd_platform_driver_probe(struct platform_device* pdev)
+static int pcd_probe_device(struct platform_device* pdev)
 {
     int ret;
     struct pcdev_private_data* dev_data;
+    struct pcd_store *store;
     struct pcdev_platform_data *pdata;
     struct device *dev = &pdev->dev;
     struct of_device_id *match;
     int driver_data;
+    int minor;
     
-    dev_info(dev, "Device detected\n");
+    dev_dbg(dev, "Device detected\n");
 
     //Match will be NULL if kernel does not support device tree i.e CONFIG_OF is off
     match = (struct of_device_id*)of_match_device(pdev->dev.driver->of_match_table, dev);
@@ -167,14 +414,24 @@ int pcd_platform_driver_probe(struct platform_device* pdev)
     }
 
 
-    dev_data = (struct pcdev_private_data*)devm_kzalloc(&pdev->dev, sizeof(struct pcdev_private_data), GFP_KERNEL);
+    //Not devm, open files and their mappings may outlive the platform device
+    dev_data = (struct pcdev_private_data*)kzalloc(sizeof(struct pcdev_private_data), GFP_KERNEL);
     if(!dev_data){
         dev_info(dev, "Can't allocate memory\n");
         ret = -ENOMEM;
         goto out;
     }
 
+    kref_init(&dev_data->ref);
     mutex_init(&dev_data->pcd_lock);
+    mutex_init(&dev_data->resize_lock);
+    mutex_init(&dev_data->fifo_read_lock);
+    seqcount_mutex_init(&dev_data->pcd_seq, &dev_data->pcd_lock);
+    init_waitqueue_head(&dev_data->fifo_wq);
+    init_waitqueue_head(&dev_data->value_wq);
+    //Set up before anything can fail so that pcd_dev_release can undo a partial probe
+    pcd_compress_init(dev_data);
+    pcd_integrity_init(dev_data);
     
     //Save dev private data in the platform device driver data field
     //pdev->dev.driver_data = dev_data;
@@ -182,73 +439,188 @@ int pcd_platform_driver_probe(struct platform_device* pdev)
 
     dev_data->pdata.size = pdata->size;
     dev_data->pdata.perm = pdata->perm;
-    dev_data->pdata.serial_number = pdata->serial_number;
+    //Platform data may go away with the platform device, the device may outlive it
+    dev_data->pdata.serial_number = kstrdup(pdata->serial_number, GFP_KERNEL);
+    if(!dev_data->pdata.serial_number){
+        ret = -ENOMEM;
+        goto out;
+    }
+    dev_data->pdata.mode = pdata->mode;
+    dev_data->pdata.backing_file = pdata->backing_file;
+    dev_data->pdata.compress_interval_ms = pdata->compress_interval_ms;
+    dev_data->pdata.integrity = pdata->integrity;
+
+    //Console output is slow on the board, keep per-device probe chatter out of the boot log
+    pr_debug("Device serial number = %s\n",dev_data->pdata.serial_number);
+    pr_debug("Device size = %d\n",dev_data->pdata.size);
+    pr_debug("Device permission = %d\n",dev_data->pdata.perm);
+    pr_debug("Device mode = %s\n",pcd_mode_name(dev_data->pdata.mode));
+
+    pr_debug("ConfigItem1 = %d\n", pcdev_config[driver_data].configItem1);
+    pr_debug("ConfigItem2 = %d\n", pcdev_config[driver_data].configItem2);
+    
+    //Ring contents are transient, only random access devices are checksummed
+    if(dev_data->pdata.integrity && dev_data->pdata.mode != PCD_MODE_RANDOM){
+        dev_info(dev, "Integrity checking ignored for %s device\n", pcd_mode_name(dev_data->pdata.mode));
+        dev_data->pdata.integrity = false;
+    }
 
-    pr_info("Device serial number = %s\n",dev_data->pdata.serial_number);
-    pr_info("Device size = %d\n",dev_data->pdata.size);
-    pr_info("Device permission = %d\n",dev_data->pdata.perm);
+    if(dev_data->pdata.mode == PCD_MODE_SHM){
+        ret = pcd_ring_init(dev, dev_data);
+        if(ret)
+            goto out;
+    }
 
-    pr_info("ConfigItem1 = %d\n", pcdev_config[driver_data].configItem1);
-    pr_info("ConfigItem2 = %d\n", pcdev_config[driver_data].configItem2);
-    
-    //Dynamically allocate mem for device buffer using size info and platform data
-    dev_data->buffer = (char*)devm_kzalloc(&pdev->dev, dev_data->pdata.size, GFP_KERNEL);
-    if(!dev_data->buffer){
+    //Only the page array is allocated here, pages are allocated as they are written
+    store = pcd_store_alloc(dev_data->pdata.size, dev_data->pdata.integrity);
+    if(!store){
         pr_info("Can't allocate memory\n");
         ret = -ENOMEM;
         goto out;
     }
 
+    RCU_INIT_POINTER(dev_data->store, store);
+
+    dev_data->stats = pcd_stats_alloc();
+    if(!dev_data->stats){
+        pr_info("Can't allocate memory\n");
+        ret = -ENOMEM;
+        goto out;
+    }
+
+    //Persistence only makes sense for random access contents
+    if(dev_data->pdata.backing_file && dev_data->pdata.mode != PCD_MODE_RANDOM)
+        dev_info(dev, "Backing file ignored for %s device\n", pcd_mode_name(dev_data->pdata.mode));
+    else if(dev_data->pdata.backing_file){
+        ret = pcd_backing_init(dev, dev_data, dev_data->pdata.backing_file);
+        if(ret)
+            goto out;
+    }
+
+    if(dev_data->pdata.compress_interval_ms && dev_data->pdata.mode != PCD_MODE_RANDOM)
+        dev_info(dev, "Compression ignored for %s device\n", pcd_mode_name(dev_data->pdata.mode));
+    else if(dev_data->pdata.compress_interval_ms){
+        ret = pcd_compress_set_interval(dev_data, dev_data->pdata.compress_interval_ms);
+        if(ret)
+            goto out;
+    }
+
+    //Lowest free minor, reused once its device is removed
+    minor = ida_alloc_max(&pcdrv_data.minor_ida, pcdrv_data.max_devices - 1, GFP_KERNEL);
+    if(minor < 0){
+        dev_err(dev, "No free minor, max_devices = %u\n", pcdrv_data.max_devices);
+        ret = minor;
+        goto out;
+    }
+
     //Get device number
-    dev_data->dev_num = pcdrv_data.device_num_base + pcdrv_data.total_devices;
+    dev_data->dev_num = pcdrv_data.device_num_base + minor;
 
-    //cdev init and add
-    cdev_init(&dev_data->cdev, &pcd_fops);
-    dev_data->cdev.owner = THIS_MODULE;
-	ret = cdev_add(&dev_data->cdev, dev_data->dev_num, 1);
+    ret = xa_insert(&pcdrv_data.devices, minor, dev_data, GFP_KERNEL);
+    if(ret)
+        goto free_minor;
+
+    //cdev alloc and add
+    dev_data->cdev = cdev_alloc();
+    if(!dev_data->cdev){
+        ret = -ENOMEM;
+        goto xa_del;
+    }
+    dev_data->cdev->ops = &pcd_fops;
+    dev_data->cdev->owner = THIS_MODULE;
+	ret = cdev_add(dev_data->cdev, dev_data->dev_num, 1);
 	if(ret < 0)
-		goto out;
+		goto cdev_put;
         
     //Create device file for the detected platform device
-    pcdrv_data.device_pcd = device_create(pcdrv_data.class_pcd, dev, dev_data->dev_num, NULL, "pcdev-%d",pcdrv_data.total_devices);
-    if(IS_ERR(pcdrv_data.device_pcd))
+    dev_data->device = device_create_with_groups(pcdrv_data.class_pcd, dev, dev_data->dev_num, NULL,
+        pcd_attr_groups, "pcdev-%d",minor);
+    if(IS_ERR(dev_data->device))
     {
         dev_err(dev, "Device creation failed!");
-        ret = PTR_ERR(pcdrv_data.device_pcd);
+        ret = PTR_ERR(dev_data->device);
+        dev_data->device = NULL;
         goto cdev_del;
     }
-
-    pcdrv_data.total_devices++;
-
-    ret = pcd_sysfs_create_files(pcdrv_data.device_pcd);
-    if (ret){
-        device_destroy(pcdrv_data.class_pcd, dev_data->dev_num);
-        goto out;
+    //Integrity reports still name it after remove destroyed it
+    get_device(dev_data->device);
+
+    //The char device stays usable without its block front-end
+    if(dev_data->pdata.mode == PCD_MODE_RANDOM){
+        ret = pcd_blk_add(dev_data, minor);
+        if(ret)
+            dev_warn(dev, "Block device creation failed: %d\n", ret);
+        ret = 0;
     }
 
-    pr_info("Probe successful!\n");
     return 0;
 
 cdev_del:
-    cdev_del(&dev_data->cdev);
+    cdev_del(dev_data->cdev);
+    goto xa_del;
+cdev_put:
+    kobject_put(&dev_data->cdev->kobj);
+xa_del:
+    xa_erase(&pcdrv_data.devices, minor);
+free_minor:
+    ida_free(&pcdrv_data.minor_ida, minor);
 out:
     dev_info(dev, "Device probe failed\n");
     return ret;
 }
 
+//Called when matching device is found
+int pcd_platform_driver_probe(struct platform_device* pdev)
+{
+    struct pcdev_private_data *dev_data;
+    u64 start = ktime_get_ns();
+    u64 latency;
+    int ret;
+
+    ret = pcd_probe_device(pdev);
+    latency = ktime_get_ns() - start;
+
+    //Driver data is only set once the private data has been allocated
+    dev_data = dev_get_drvdata(&pdev->dev);
+    if(dev_data){
+        //Kept for the probe_time_us attribute
+        dev_data->probe_ns = latency;
+        trace_pcd_probe(dev_name(&pdev->dev), dev_data->pdata.size, dev_data->pdata.perm,
+            dev_data->pdata.mode, ret, latency);
+        //Nothing was published, this is the only reference
+        if(ret){
+            dev_set_drvdata(&pdev->dev, NULL);
+            pcd_dev_put(dev_data);
+        }
+    }
+    else
+        trace_pcd_probe(dev_name(&pdev->dev), 0, 0, 0, ret, latency);
+
+    return ret;
+}
+
 //Remove gets called when device is removed from system
 int pcd_platform_driver_remove(struct platform_device* pdev)
 {
     struct pcdev_private_data *dev_data = (struct pcdev_private_data*)pdev->dev.driver_data;
+    unsigned int minor = MINOR(dev_data->dev_num) - MINOR(pcdrv_data.device_num_base);
+
+    trace_pcd_remove(dev_data->dev_num, dev_data->pdata.serial_number);
+
+    //New opens fail from here on, files that are open keep the device
+    xa_erase(&pcdrv_data.devices, minor);
+    pcd_blk_remove(dev_data);
+
     //Remove a device created with device_create()
     device_destroy(pcdrv_data.class_pcd, dev_data->dev_num);
 
     //Remove cdev entry from system
-    cdev_del(&dev_data->cdev);
+    cdev_del(dev_data->cdev);
+
+    ida_free(&pcdrv_data.minor_ida, minor);
 
-    pcdrv_data.total_devices--;
-    
     dev_info(&pdev->dev, "Device removed\n");
+    pcd_dev_put(dev_data);
     return 0;
 }
 
@@ -298,16 +670,143 @@ struct platform_driver pcd_platform_driver = {
     .id_table = pcdev_ids,
     .driver = {
         .name = "pseudo-char-device",
+        //Devices are independent of each other, probe them off the boot critical path
+        .probe_type = PROBE_PREFER_ASYNCHRONOUS,
         .of_match_table = of_match_ptr(org_pcdev_dt_match)
     }
 };
 
+/*of_update_property() notifies before it changes the node, overlays after.
+The property being changed is taken from the notification, the others from
+the node*/
+static struct property* pcd_of_prop(struct device_node *np, struct property *changed, const char *name)
+{
+    return strcmp(changed->name, name) ? of_find_property(np, name, NULL) : changed;
+}
+
+static int pcd_of_prop_u32(struct property *prop, u32 *val)
+{
+    if(!prop || !prop->value || prop->length != sizeof(__be32))
+        return -EINVAL;
+    *val = be32_to_cpup(prop->value);
+    return 0;
+}
+
+static const char* pcd_of_prop_string(struct property *prop)
+{
+    if(!prop || !prop->length || strnlen(prop->value, prop->length) != prop->length - 1)
+        return NULL;
+    return prop->value;
+}
+
+/*Size, permission and serial number are applied to the live device, its
+contents stay. Other properties take effect on the next probe. All three are
+checked before any of them is applied, a bad value leaves the device as it was*/
+static int pcd_of_update(struct pcdev_private_data *dev_data, struct device *dev, struct device_node *np,
+    struct property *changed)
+{
+    const char *serial, *old_serial;
+    char *new_serial = NULL;
+    u32 size, perm;
+    int ret;
+
+    if(strcmp(changed->name, "org,size") && strcmp(changed->name, "org,perm") &&
+            strcmp(changed->name, "org,device-serial-num"))
+        return 0;
+
+    ret = pcd_of_prop_u32(pcd_of_prop(np, changed, "org,size"), &size);
+    if(!ret)
+        ret = pcd_resize_check(dev_data, size);
+    if(!ret)
+        ret = pcd_of_prop_u32(pcd_of_prop(np, changed, "org,perm"), &perm);
+    if(!ret && perm != RDWR && perm != RDONLY && perm != WRONLY)
+        ret = -EINVAL;
+    serial = pcd_of_prop_string(pcd_of_prop(np, changed, "org,device-serial-num"));
+    if(!ret && !serial)
+        ret = -EINVAL;
+    if(ret)
+        goto out;
+
+    //The property goes away with its overlay, keep a copy
+    if(strcmp(serial, dev_data->pdata.serial_number)){
+        new_serial = kstrdup(serial, GFP_KERNEL);
+        if(!new_serial){
+            ret = -ENOMEM;
+            goto out;
+        }
+    }
+
+    //Resizing is the only step that can still fail
+    if(size != READ_ONCE(dev_data->pdata.size)){
+        ret = pcd_resize(dev_data, size);
+        if(ret){
+            kfree(new_serial);
+            goto out;
+        }
+    }
+
+    //Write-back prints the serial number under resize_lock, the attribute under pcd_lock
+    mutex_lock(&dev_data->resize_lock);
+    mutex_lock(&dev_data->pcd_lock);
+    //Checked at open, files that are open already keep their access
+    WRITE_ONCE(dev_data->pdata.perm, perm);
+    old_serial = dev_data->pdata.serial_number;
+    if(new_serial)
+        dev_data->pdata.serial_number = new_serial;
+    mutex_unlock(&dev_data->pcd_lock);
+    mutex_unlock(&dev_data->resize_lock);
+    if(new_serial)
+        kfree(old_serial);
+    pcd_blk_set_perm(dev_data);
+
+out:
+    if(ret)
+        dev_warn(dev, "Can't apply %s: %d\n", changed->name, ret);
+    else
+        dev_info(dev, "Applied %s\n", changed->name);
+    return ret;
+}
+
+/*Property changes of DT nodes, e.g. from applying overlays/pcdev0.dts. Only
+the device whose node changed is locked, the others stay available*/
+static int pcd_of_notify(struct notifier_block *nb, unsigned long action, void *arg)
+{
+    struct of_reconfig_data *rd = arg;
+    struct pcdev_private_data *dev_data;
+    struct platform_device *pdev;
+    int ret = 0;
+
+    if(action != OF_RECONFIG_ADD_PROPERTY && action != OF_RECONFIG_UPDATE_PROPERTY)
+        return NOTIFY_DONE;
+
+    pdev = of_find_device_by_node(rd->dn);
+    if(!pdev)
+        return NOTIFY_DONE;
+
+    //The device lock keeps probe and remove out, nodes bound to other drivers are skipped
+    device_lock(&pdev->dev);
+    dev_data = dev_get_drvdata(&pdev->dev);
+    if(pdev->dev.driver == &pcd_platform_driver.driver && dev_data)
+        ret = pcd_of_update(dev_data, &pdev->dev, rd->dn, rd->prop);
+    device_unlock(&pdev->dev);
+    put_device(&pdev->dev);
+
+    return notifier_from_errno(ret);
+}
+
+static struct notifier_block pcd_of_nb = {
+    .notifier_call = pcd_of_notify
+};
+
 
 static int __init pcd_platform_driver_init(void)
 {
     int ret;
-    //Dynamically allocate a device number for MAX_DEVICES
-    ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, MAX_DEVICES, "pcd_devices");
+    if(!pcdrv_data.max_devices || pcdrv_data.max_devices > MINORMASK + 1)
+        return -EINVAL;
+
+    //Dynamically allocate a device number for max_devices
+    ret = alloc_chrdev_region(&pcdrv_data.device_num_base, 0, pcdrv_data.max_devices, "pcd_devices");
     if(ret < 0)
 		goto out;
     
@@ -320,14 +819,52 @@ static int __init pcd_platform_driver_init(void)
 		goto unreg_chrdev;
 	}
 
+    //Write-back of file backed devices, may run while the system reclaims memory
+    pcdrv_data.writeback_wq = alloc_workqueue("pcd_writeback", WQ_UNBOUND | WQ_MEM_RECLAIM, 0);
+    if(!pcdrv_data.writeback_wq){
+        ret = -ENOMEM;
+        goto class_del;
+    }
+
+    ret = pcd_cow_init();
+    if(ret)
+        goto wq_del;
+
+    ret = pcd_blk_init();
+    if(ret)
+        goto cow_del;
+
     //Register platform driver
     platform_driver_register(&pcd_platform_driver);
 
+    //Devices made under /sys/kernel/config/pcd bind to the driver registered above
+    ret = pcd_configfs_init();
+    if(ret)
+        goto drv_del;
+
+    //Without CONFIG_OF_DYNAMIC there are no overlays and property changes to follow
+    if(IS_ENABLED(CONFIG_OF_DYNAMIC)){
+        ret = of_reconfig_notifier_register(&pcd_of_nb);
+        if(ret)
+            goto cfg_del;
+    }
+
     pr_info("pcd platform driver loaded\n");
     return 0;
 
+cfg_del:
+    pcd_configfs_exit();
+drv_del:
+    platform_driver_unregister(&pcd_platform_driver);
+    pcd_blk_exit();
+cow_del:
+    pcd_cow_exit();
+wq_del:
+    destroy_workqueue(pcdrv_data.writeback_wq);
+class_del:
+    class_destroy(pcdrv_data.class_pcd);
 unreg_chrdev:
-	unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
+	unregister_chrdev_region(pcdrv_data.device_num_base, pcdrv_data.max_devices);
 out:
 	pr_info("Module insertion failed!\n");
 	return ret;
@@ -335,9 +872,18 @@ out:
 
 static void __exit pcd_platform_driver_cleanup(void)
 {
+    if(IS_ENABLED(CONFIG_OF_DYNAMIC))
+        of_reconfig_notifier_unregister(&pcd_of_nb);
+    pcd_configfs_exit();
     platform_driver_unregister(&pcd_platform_driver);
+    //Retired stores still hold shared pages until their RCU callbacks ran
+    rcu_barrier();
+    pcd_blk_exit();
+    pcd_cow_exit();
+    destroy_workqueue(pcdrv_data.writeback_wq);
     class_destroy(pcdrv_data.class_pcd);
-	unregister_chrdev_region(pcdrv_data.device_num_base, MAX_DEVICES);
+	unregister_chrdev_region(pcdrv_data.device_num_base, pcdrv_data.max_devices);
+    ida_destroy(&pcdrv_data.minor_ida);
     pr_info("pcd platform driver unloaded\n");
 }
 
@@ -11,9 +11,32 @@
 #include <linux/mod_devicetable.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
+#include <linux/of_platform.h>
 #include <linux/slab.h>
 #include <linux/mutex.h>
+#include <linux/mm.h>
+#include <linux/seqlock.h>
+#include <linux/rcupdate.h>
+#include <linux/uio.h>
+#include <linux/splice.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
+#include <linux/xarray.h>
+#include <linux/blk-mq.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
 #include "platform.h"
+#include "pcd_stats.h"
+#include "pcd_store.h"
+#include "pcd_backing.h"
+#include "pcd_compress.h"
+#include "pcd_cow.h"
+#include "pcd_blk.h"
+#include "pcd_integrity.h"
+#include "pcd_bcast.h"
+#include "pcd_ring.h"
 
 #undef pr_fmt
 #define pr_fmt(fmt) "%s :" fmt,__func__
@@ -36,19 +59,132 @@ struct device_config
 struct pcdev_private_data
 {
     struct pcdev_platform_data pdata;
-    char* buffer;
+    /*Held by probe and by every open file, which also covers its mappings.
+    The store and everything else below is released with the last one*/
+    struct kref ref;
+    //Published with RCU, replaced as a whole on resize
+    struct pcd_store __rcu *store;
     dev_t dev_num;
-    struct cdev cdev;
+    //Allocated on its own, the char device core may still hold it after the last put
+    struct cdev *cdev;
+    //Device file created with device_create(), referenced until the last put
+    struct device *device;
+    //Set once the work deferred from probe to the first open is done
+    bool ready;
+    u64 probe_ns;
     struct mutex pcd_lock;
+    //Serializes resizes so that building a new store does not hold up pcd_lock
+    struct mutex resize_lock;
+    //Lets readers run without pcd_lock, writers bump it while holding pcd_lock
+    seqcount_mutex_t pcd_seq;
+    //FIFO mode ring state, protected by pcd_lock
+    size_t fifo_head;
+    size_t fifo_len;
+    //Held by a FIFO reader until the bytes it took reached user space
+    struct mutex fifo_read_lock;
+    //Woken when a ring changes, FIFO and broadcast mode
+    wait_queue_head_t fifo_wq;
+    /*Broadcast mode ring state, protected by pcd_lock and pcd_seq. Positions
+    only grow, the offset in the store is the position modulo the size*/
+    u64 bc_next_seq;
+    u64 bc_oldest_seq;
+    u64 bc_write_pos;
+    u64 bc_oldest_pos;
+    //Shared memory ring mode, indices page mapped by user space at offset 0
+    struct pcd_ring_ctrl *ring_ctrl;
+    //PCD_IOC_WAIT sleepers, woken by every write
+    wait_queue_head_t value_wq;
+    //Per-CPU I/O counters exposed under stats/ in sysfs
+    struct pcd_stats __percpu *stats;
+    //Optional backing file, dirty pages are written back from writeback_work
+    struct file *backing_file;
+    loff_t backing_size;
+    unsigned long *dirty_map;
+    unsigned long dirty_nr;
+    struct delayed_work writeback_work;
+    /*Inode of the first open. Every open maps through its address space so a
+    resize can zap the mappings of all of them, it is pinned until the last put*/
+    struct inode *map_inode;
+    //Compressed images of cold pages by page index, their store slots are NULL
+    struct xarray zpages;
+    unsigned long zpages_nr;
+    size_t zbytes;
+    struct crypto_comp *ztfm;
+    void *zscratch;
+    //Cold page scan period, 0 while compression is off
+    unsigned int zinterval_ms;
+    struct delayed_work zscan_work;
+    //Block device front-end /dev/pcdblkN, random access devices only
+    struct gendisk *disk;
+    struct blk_mq_tag_set tag_set;
+    //Integrity checking, the page checksums themselves live in the store
+    bool verify_reads;
+    unsigned long scrub_flags;
+    struct work_struct scrub_work;
+    unsigned long scrub_pages;
+    unsigned long scrub_errors;
+    u64 scrub_ns;
 };
 
+//Per open file state, filp->private_data of every pcd file
+struct pcd_file
+{
+    struct pcdev_private_data *dev_data;
+    //Broadcast mode read cursor, the next record this reader gets
+    struct mutex bc_lock;
+    u64 bc_seq;
+    u64 bc_pos;
+};
+
+static inline struct pcdev_private_data* pcd_file_dev(struct file *filp)
+{
+    return ((struct pcd_file *)filp->private_data)->dev_data;
+}
+
+//Store of a device as seen by a pcd_lock holder, only a resize publishes a new one under it
+static inline struct pcd_store* pcd_locked_store(struct pcdev_private_data *dev_data)
+{
+    return rcu_dereference_protected(dev_data->store, lockdep_is_held(&dev_data->pcd_lock));
+}
+
+//Called after modifying the device contents, a no-op unless someone waits for a word to change
+static inline void pcd_wake_value_waiters(struct pcdev_private_data *dev_data)
+{
+    if(wq_has_sleeper(&dev_data->value_wq))
+        wake_up_interruptible_all(&dev_data->value_wq);
+}
+
+//Drop the user mappings of [start, start + len), of every open file. A len of 0 runs to the end
+static inline void pcd_unmap_range(struct pcdev_private_data *dev_data, loff_t start, loff_t len)
+{
+    struct inode *inode = smp_load_acquire(&dev_data->map_inode);
+
+    //Set before the first file could be mapped, nothing to zap without it
+    if(inode)
+        unmap_mapping_range(inode->i_mapping, start, len, 1);
+}
+
 //Driver private data structure
 struct pcdrv_private_data
 {
-    int total_devices;
+    //Minors handed out to probed devices, freed again on remove
+    struct ida minor_ida;
+    //Probed devices by minor, open takes its reference through here
+    struct xarray devices;
+    unsigned int max_devices;
     dev_t device_num_base;
     struct class *class_pcd;
-    struct device *device_pcd;
+    struct workqueue_struct *writeback_wq;
+    //Backs every page that has not been written yet, on all devices
+    struct page *zero_page;
+    u32 zero_csum;
 };
 
+extern struct pcdrv_private_data pcdrv_data;
+
+struct pcdev_private_data* pcd_dev_get(unsigned int minor);
+void pcd_dev_put(struct pcdev_private_data *dev_data);
+const char* pcd_mode_name(int mode);
+int pcd_mode_from_name(const char *name);
+
 #endif
@@ -0,0 +1,121 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_ioctl.h"
+#include <linux/log2.h>
+
+/*Shared memory ring mode: producer and consumer map the device and move data
+with plain loads and stores, see struct pcd_ring_ctrl for the protocol. The
+driver only hands out the pages and puts sides that found the ring empty or
+full to sleep in poll(). read() and write() are not supported, the indices
+belong to user space*/
+
+//Data pages are mapped twice, which needs whole pages, and indices wrap at 2^32
+bool pcd_ring_size_ok(size_t size)
+{
+    return size >= PAGE_SIZE && is_power_of_2(size);
+}
+
+int pcd_ring_init(struct device *dev, struct pcdev_private_data *dev_data)
+{
+    unsigned long addr;
+
+    if(!pcd_ring_size_ok(dev_data->pdata.size)){
+        dev_info(dev, "Ring size must be a power of two of at least %lu bytes\n", PAGE_SIZE);
+        return -EINVAL;
+    }
+
+    /*User space maps it, so it is a page of its own. Mappings keep their own
+    reference, the device's is dropped by its last put*/
+    addr = get_zeroed_page(GFP_KERNEL);
+    if(!addr)
+        return -ENOMEM;
+
+    dev_data->ring_ctrl = (struct pcd_ring_ctrl *)addr;
+    dev_data->ring_ctrl->size = dev_data->pdata.size;
+    dev_data->ring_ctrl->data_offset = PAGE_SIZE;
+    return 0;
+}
+
+/*Called by a resize with pcd_lock held. The new store starts out as an empty
+ring, peers have to map the device again anyway since their mappings are zapped*/
+void pcd_ring_reset(struct pcdev_private_data *dev_data)
+{
+    struct pcd_ring_ctrl *ctrl = dev_data->ring_ctrl;
+
+    lockdep_assert_held(&dev_data->pcd_lock);
+    WRITE_ONCE(ctrl->size, dev_data->pdata.size);
+    WRITE_ONCE(ctrl->head, 0);
+    WRITE_ONCE(ctrl->tail, 0);
+}
+
+//Offset 0 is the control page, the data pages follow twice in a row
+static vm_fault_t pcd_ring_fault(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *dev_data = vmf->vma->vm_private_data;
+    struct pcd_store *store;
+    struct page *page = NULL;
+
+    /*Ring pages are never compressed or shared. A resize frees the old ones
+    only after a grace period, the reference taken here outlives that*/
+    rcu_read_lock();
+    store = rcu_dereference(dev_data->store);
+    if(!vmf->pgoff)
+        page = virt_to_page(dev_data->ring_ctrl);
+    else if(vmf->pgoff - 1 < 2 * store->nr_pages)
+        page = READ_ONCE(store->pages[(vmf->pgoff - 1) % store->nr_pages]);
+    if(page)
+        get_page(page);
+    rcu_read_unlock();
+
+    if(!page)
+        return VM_FAULT_SIGBUS;
+
+    vmf->page = page;
+    return 0;
+}
+
+static const struct vm_operations_struct pcd_ring_vm_ops = {
+    .fault = pcd_ring_fault
+};
+
+int pcd_ring_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *dev_data = pcd_file_dev(filp);
+    unsigned long limit = 1 + 2 * PFN_DOWN(READ_ONCE(dev_data->pdata.size));
+
+    //vm_pgoff comes from user space, compared against what is left so the sum can't wrap
+    if(vma_pages(vma) > limit || vma->vm_pgoff > limit - vma_pages(vma))
+        return -EINVAL;
+
+    vma->vm_ops = &pcd_ring_vm_ops;
+    vma->vm_private_data = dev_data;
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+    return 0;
+}
+
+/*Indices are written by user space and only compared here. The size comes
+from the device, the copy in the control page is writable by the mapping*/
+__poll_t pcd_ring_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct pcdev_private_data *dev_data = pcd_file_dev(filp);
+    struct pcd_ring_ctrl *ctrl = dev_data->ring_ctrl;
+    __poll_t mask = 0;
+    u32 head, tail;
+
+    poll_wait(filp, &dev_data->fifo_wq, wait);
+
+    head = smp_load_acquire(&ctrl->head);
+    tail = smp_load_acquire(&ctrl->tail);
+    if(head != tail)
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if(head - tail < (u32)READ_ONCE(dev_data->pdata.size))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
+//PCD_IOC_WAKE, a side that moved an index found the other one asleep
+void pcd_ring_wake(struct pcdev_private_data *dev_data)
+{
+    wake_up_interruptible_poll(&dev_data->fifo_wq, EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM);
+}
@@ -0,0 +1,19 @@
+#ifndef PCD_RING_H
+#define PCD_RING_H
+
+#include <linux/types.h>
+
+struct pcdev_private_data;
+struct device;
+struct file;
+struct vm_area_struct;
+struct poll_table_struct;
+
+bool pcd_ring_size_ok(size_t size);
+int pcd_ring_init(struct device *dev, struct pcdev_private_data *dev_data);
+void pcd_ring_reset(struct pcdev_private_data *dev_data);
+int pcd_ring_mmap(struct file *filp, struct vm_area_struct *vma);
+__poll_t pcd_ring_poll(struct file *filp, struct poll_table_struct *wait);
+void pcd_ring_wake(struct pcdev_private_data *dev_data);
+
+#endif
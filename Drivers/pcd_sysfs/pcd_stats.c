@@ -0,0 +1,189 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/log2.h>
+
+static inline int pcd_hist_bucket(u64 latency_ns)
+{
+    if(!latency_ns)
+        return 0;
+    return min_t(int, ilog2(latency_ns), PCD_HIST_BUCKETS - 1);
+}
+
+struct pcd_stats __percpu *pcd_stats_alloc(void)
+{
+    struct pcd_stats __percpu *stats = alloc_percpu(struct pcd_stats);
+    int cpu;
+
+    if(!stats)
+        return NULL;
+
+    for_each_possible_cpu(cpu)
+        u64_stats_init(&per_cpu_ptr(stats, cpu)->syncp);
+
+    return stats;
+}
+
+//Accounting only touches this CPU's counters, so concurrent ops never contend on them
+static void pcd_stats_account_errors(struct pcd_stats *s, ssize_t ret)
+{
+    if(ret == -EFAULT)
+        s->efault++;
+    else if(ret == -ENOMEM)
+        s->enomem++;
+}
+
+void pcd_stats_account_read(struct pcdev_private_data *dev_data, size_t count, ssize_t ret, u64 latency_ns)
+{
+    unsigned long flags;
+    struct pcd_stats *s = pcd_stats_begin(dev_data->stats, &flags);
+
+    s->read_ops++;
+    s->read_hist[pcd_hist_bucket(latency_ns)]++;
+    if(ret < 0)
+        pcd_stats_account_errors(s, ret);
+    else {
+        s->read_bytes += ret;
+        if((size_t)ret < count)
+            s->short_reads++;
+    }
+
+    pcd_stats_end(s, flags);
+}
+
+void pcd_stats_account_write(struct pcdev_private_data *dev_data, size_t count, ssize_t ret, u64 latency_ns)
+{
+    unsigned long flags;
+    struct pcd_stats *s = pcd_stats_begin(dev_data->stats, &flags);
+
+    s->write_ops++;
+    s->write_hist[pcd_hist_bucket(latency_ns)]++;
+    if(ret < 0)
+        pcd_stats_account_errors(s, ret);
+    else {
+        s->write_bytes += ret;
+        if((size_t)ret < count)
+            s->short_writes++;
+    }
+
+    pcd_stats_end(s, flags);
+}
+
+void pcd_stats_account_lock_wait(struct pcdev_private_data *dev_data, u64 wait_ns)
+{
+    pcd_stats_add(dev_data->stats, lock_wait_ns, wait_ns);
+}
+
+//Sum the u64 at the given offset of struct pcd_stats over all CPUs
+static u64 pcd_stats_sum(struct pcdev_private_data *dev_data, size_t offset)
+{
+    struct pcd_stats *s;
+    unsigned int start;
+    u64 sum = 0, val;
+    int cpu;
+
+    for_each_possible_cpu(cpu){
+        s = per_cpu_ptr(dev_data->stats, cpu);
+        do {
+            start = u64_stats_fetch_begin(&s->syncp);
+            val = *(u64*)((char*)s + offset);
+        } while(u64_stats_fetch_retry(&s->syncp, start));
+        sum += val;
+    }
+
+    return sum;
+}
+
+#define PCD_STAT_ATTR(field) \
+static ssize_t show_##field(struct device *dev, struct device_attribute *attr, char* buf) \
+{ \
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent); \
+    return sprintf(buf,"%llu\n",pcd_stats_sum(dev_data, offsetof(struct pcd_stats, field))); \
+} \
+static DEVICE_ATTR(field, S_IRUGO, show_##field, NULL)
+
+PCD_STAT_ATTR(read_ops);
+PCD_STAT_ATTR(read_bytes);
+PCD_STAT_ATTR(write_ops);
+PCD_STAT_ATTR(write_bytes);
+PCD_STAT_ATTR(short_reads);
+PCD_STAT_ATTR(short_writes);
+PCD_STAT_ATTR(efault);
+PCD_STAT_ATTR(enomem);
+PCD_STAT_ATTR(lock_wait_ns);
+PCD_STAT_ATTR(compress_hits);
+PCD_STAT_ATTR(compress_misses);
+PCD_STAT_ATTR(csum_ns);
+PCD_STAT_ATTR(csum_bytes);
+PCD_STAT_ATTR(csum_errors);
+PCD_STAT_ATTR(missed_records);
+
+//One line per non-empty bucket: lower bound in ns followed by the op count
+static ssize_t pcd_show_hist(struct pcdev_private_data *dev_data, size_t offset, char* buf)
+{
+    ssize_t len = 0;
+    u64 count;
+    int i;
+
+    for(i = 0; i < PCD_HIST_BUCKETS; i++){
+        count = pcd_stats_sum(dev_data, offset + i * sizeof(u64));
+        if(count)
+            len += scnprintf(buf + len, PAGE_SIZE - len, "%llu %llu\n", 1ULL << i, count);
+    }
+
+    return len;
+}
+
+static ssize_t show_read_latency_hist(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return pcd_show_hist(dev_data, offsetof(struct pcd_stats, read_hist), buf);
+}
+
+static ssize_t show_write_latency_hist(struct device *dev, struct device_attribute *attr, char* buf)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    return pcd_show_hist(dev_data, offsetof(struct pcd_stats, write_hist), buf);
+}
+
+//Any write clears the counters, updates racing with the reset may survive it. syncp is left alone
+static ssize_t store_reset(struct device *dev, struct device_attribute *attr, const char* buf, size_t count)
+{
+    struct pcdev_private_data *dev_data = dev_get_drvdata(dev->parent);
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        memset(per_cpu_ptr(dev_data->stats, cpu), 0, offsetof(struct pcd_stats, syncp));
+
+    return count;
+}
+
+static DEVICE_ATTR(read_latency_hist, S_IRUGO, show_read_latency_hist, NULL);
+static DEVICE_ATTR(write_latency_hist, S_IRUGO, show_write_latency_hist, NULL);
+static DEVICE_ATTR(reset, S_IWUSR, NULL, store_reset);
+
+struct attribute* pcd_stats_attrs[] = {
+    &dev_attr_read_ops.attr,
+    &dev_attr_read_bytes.attr,
+    &dev_attr_write_ops.attr,
+    &dev_attr_write_bytes.attr,
+    &dev_attr_short_reads.attr,
+    &dev_attr_short_writes.attr,
+    &dev_attr_efault.attr,
+    &dev_attr_enomem.attr,
+    &dev_attr_lock_wait_ns.attr,
+    &dev_attr_compress_hits.attr,
+    &dev_attr_compress_misses.attr,
+    &dev_attr_csum_ns.attr,
+    &dev_attr_csum_bytes.attr,
+    &dev_attr_csum_errors.attr,
+    &dev_attr_missed_records.attr,
+    &dev_attr_read_latency_hist.attr,
+    &dev_attr_write_latency_hist.attr,
+    &dev_attr_reset.attr,
+    NULL
+};
+
+//Shows up as the stats/ directory of each pcdev
+struct attribute_group pcd_stats_attr_group = {
+    .name = "stats",
+    .attrs = pcd_stats_attrs
+};
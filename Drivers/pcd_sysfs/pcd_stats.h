@@ -0,0 +1,75 @@
+#ifndef PCD_STATS_H
+#define PCD_STATS_H
+
+#include <linux/types.h>
+#include <linux/percpu.h>
+#include <linux/sysfs.h>
+#include <linux/u64_stats_sync.h>
+
+//Latency histogram buckets, bucket i counts ops that took [2^i, 2^(i+1)) ns
+#define PCD_HIST_BUCKETS 32
+
+struct pcdev_private_data;
+
+/*Per-CPU I/O counters, summed over all CPUs when read from sysfs. Only the
+owning CPU updates them, between pcd_stats_begin() and pcd_stats_end(), so a
+32 bit reader never sees a torn counter*/
+struct pcd_stats
+{
+    u64 read_ops;
+    u64 read_bytes;
+    u64 write_ops;
+    u64 write_bytes;
+    u64 short_reads;
+    u64 short_writes;
+    u64 efault;
+    u64 enomem;
+    u64 lock_wait_ns;
+    //Accesses while compression is on, and the ones that had to decompress
+    u64 compress_hits;
+    u64 compress_misses;
+    //Time spent checksumming, bytes checksummed and mismatches found, integrity checking only
+    u64 csum_ns;
+    u64 csum_bytes;
+    u64 csum_errors;
+    //Broadcast records overwritten before a reader got to them, summed over readers
+    u64 missed_records;
+    u64 read_hist[PCD_HIST_BUCKETS];
+    u64 write_hist[PCD_HIST_BUCKETS];
+    //Last, a reset clears everything before it
+    struct u64_stats_sync syncp;
+};
+
+static inline struct pcd_stats* pcd_stats_begin(struct pcd_stats __percpu *stats, unsigned long *flags)
+{
+    struct pcd_stats *s = get_cpu_ptr(stats);
+
+    //Block device requests may be accounted from softirq context
+    *flags = u64_stats_update_begin_irqsave(&s->syncp);
+    return s;
+}
+
+static inline void pcd_stats_end(struct pcd_stats *s, unsigned long flags)
+{
+    u64_stats_update_end_irqrestore(&s->syncp, flags);
+    put_cpu_ptr(s);
+}
+
+//Add val to one counter of this CPU
+#define pcd_stats_add(stats, field, val) \
+do { \
+    unsigned long __flags; \
+    struct pcd_stats *__s = pcd_stats_begin(stats, &__flags); \
+    __s->field += (val); \
+    pcd_stats_end(__s, __flags); \
+} while(0)
+
+struct pcd_stats __percpu *pcd_stats_alloc(void);
+
+void pcd_stats_account_read(struct pcdev_private_data *dev_data, size_t count, ssize_t ret, u64 latency_ns);
+void pcd_stats_account_write(struct pcdev_private_data *dev_data, size_t count, ssize_t ret, u64 latency_ns);
+void pcd_stats_account_lock_wait(struct pcdev_private_data *dev_data, u64 wait_ns);
+
+extern struct attribute_group pcd_stats_attr_group;
+
+#endif
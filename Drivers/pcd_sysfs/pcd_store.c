@@ -0,0 +1,245 @@
+#include "pcd_platform_driver_dt_sysfs.h"
+#include <linux/highmem.h>
+#include <linux/crc32c.h>
+
+static struct pcd_store* pcd_store_alloc_array(size_t size, bool csum)
+{
+    struct pcd_store *store;
+    unsigned long nr_pages = DIV_ROUND_UP(size, PAGE_SIZE);
+    size_t extra = 2 * BITS_TO_LONGS(nr_pages) * sizeof(long);
+
+    //Access and shared bitmaps and the checksums live right behind the page array
+    if(csum)
+        extra += nr_pages * sizeof(u32);
+    store = kvzalloc(struct_size(store, pages, nr_pages) + extra, GFP_KERNEL);
+    if(store){
+        store->size = size;
+        store->nr_pages = nr_pages;
+        store->accessed = (unsigned long*)&store->pages[nr_pages];
+        store->shared = store->accessed + BITS_TO_LONGS(nr_pages);
+        if(csum)
+            store->csum = (u32*)(store->shared + BITS_TO_LONGS(nr_pages));
+    }
+    return store;
+}
+
+//New pages all start out as holes backed by the driver wide zero page, split on their first write
+static void pcd_store_fill(struct pcd_store *store, unsigned long from)
+{
+    unsigned long i;
+
+    for(i = from; i < store->nr_pages; i++){
+        get_page(pcdrv_data.zero_page);
+        store->pages[i] = pcdrv_data.zero_page;
+        if(store->csum)
+            store->csum[i] = pcdrv_data.zero_csum;
+    }
+    bitmap_set(store->shared, from, store->nr_pages - from);
+}
+
+static void pcd_store_put_pages(struct pcd_store *store, unsigned long from)
+{
+    unsigned long i;
+
+    for(i = from; i < store->nr_pages; i++)
+        if(store->pages[i])
+            put_page(store->pages[i]);
+}
+
+/*Allocate zeroed storage for size bytes, nothing is allocated per page until
+written. csum adds room for a checksum per page*/
+struct pcd_store* pcd_store_alloc(size_t size, bool csum)
+{
+    struct pcd_store *store;
+
+    store = pcd_store_alloc_array(size, csum);
+    if(!store)
+        return NULL;
+
+    pcd_store_fill(store, 0);
+    return store;
+}
+
+//Private copy of a shared page, the caller installs it in place of the shared one
+struct page* pcd_store_copy_page(struct page *page)
+{
+    struct page *copy = alloc_page(GFP_HIGHUSER);
+
+    if(copy)
+        copy_highpage(copy, page);
+    return copy;
+}
+
+//Give every page its own copy, for stores lockless readers never see: unpublished ones and FIFO rings
+int pcd_store_unshare(struct pcd_store *store)
+{
+    struct page *page;
+    unsigned long i;
+
+    for_each_set_bit(i, store->shared, store->nr_pages){
+        page = pcd_store_copy_page(store->pages[i]);
+        if(!page)
+            return -ENOMEM;
+        put_page(store->pages[i]);
+        store->pages[i] = page;
+        clear_bit(i, store->shared);
+    }
+    return 0;
+}
+
+void pcd_store_free(struct pcd_store *store)
+{
+    if(!store)
+        return;
+    pcd_store_put_pages(store, 0);
+    kvfree(store);
+}
+
+/*Build a store for new_size that shares the pages of old which are still in
+range, the pages it grows by start out as holes. Called with pcd_lock held
+so no slot of old changes while it is taken over. old stays valid, readers
+can keep using it until the new one is published*/
+struct pcd_store* pcd_store_resize(struct pcd_store *old, size_t new_size)
+{
+    struct pcd_store *store;
+    unsigned long keep;
+
+    store = pcd_store_alloc_array(new_size, old->csum != NULL);
+    if(!store)
+        return NULL;
+
+    keep = min(old->nr_pages, store->nr_pages);
+    memcpy(store->pages, old->pages, keep * sizeof(struct page*));
+    bitmap_copy(store->accessed, old->accessed, keep);
+    bitmap_copy(store->shared, old->shared, keep);
+    if(store->csum)
+        memcpy(store->csum, old->csum, keep * sizeof(u32));
+
+    pcd_store_fill(store, keep);
+    return store;
+}
+
+static void pcd_store_free_rcu(struct rcu_head *head)
+{
+    struct pcd_store *store = container_of(head, struct pcd_store, rcu);
+
+    pcd_store_put_pages(store, store->nr_shared);
+    kvfree(store);
+}
+
+/*Free a store that has been replaced once lockless readers are done with it.
+The first nr_shared pages now belong to the replacement and are kept*/
+void pcd_store_retire(struct pcd_store *old, unsigned long nr_shared)
+{
+    old->nr_shared = nr_shared;
+    call_rcu(&old->rcu, pcd_store_free_rcu);
+}
+
+/*Clear the bytes past size in the last page so that growing again exposes zeros.
+Shared pages are left alone, a shrink unshares the last page beforehand and
+on a grow the bytes past the old size are zero already. Nothing to do for a
+page aligned size, the last page ends there*/
+void pcd_store_zero_tail(struct pcd_store *store, size_t size)
+{
+    size_t offset = offset_in_page(size);
+
+    if(!offset)
+        return;
+
+    if(PFN_DOWN(size) < store->nr_pages && store->pages[PFN_DOWN(size)] &&
+            !test_bit(PFN_DOWN(size), store->shared)){
+        zero_user_segment(store->pages[PFN_DOWN(size)], offset, PAGE_SIZE);
+        if(store->csum)
+            pcd_store_csum_page(store, PFN_DOWN(size));
+    }
+}
+
+//Page checksums are CRC32C seeded with ~0 and not inverted, which keeps them linear for incremental updates
+u32 pcd_store_csum_buf(const void *buf)
+{
+    return crc32c(~0, buf, PAGE_SIZE);
+}
+
+//Recompute the checksum of a resident page after it changed
+void pcd_store_csum_page(struct pcd_store *store, unsigned long index)
+{
+    void *vaddr = kmap_atomic(store->pages[index]);
+
+    store->csum[index] = pcd_store_csum_buf(vaddr);
+    kunmap_atomic(vaddr);
+}
+
+//Slots without a page read as zeros, callers check for compressed pages beforehand
+void pcd_store_read(struct pcd_store *store, size_t pos, void *dst, size_t len)
+{
+    size_t offset, chunk;
+    struct page *page;
+    char *vaddr;
+
+    while(len){
+        offset = offset_in_page(pos);
+        chunk = min_t(size_t, len, PAGE_SIZE - offset);
+        page = store->pages[PFN_DOWN(pos)];
+        if(page){
+            vaddr = kmap_atomic(page);
+            memcpy(dst, vaddr + offset, chunk);
+            kunmap_atomic(vaddr);
+        }
+        else
+            memset(dst, 0, chunk);
+        dst += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+//Writers make sure every page in range is resident and private before calling this
+void pcd_store_write(struct pcd_store *store, size_t pos, const void *src, size_t len)
+{
+    size_t offset, chunk;
+    struct page *page;
+    char *vaddr;
+
+    while(len){
+        offset = offset_in_page(pos);
+        chunk = min_t(size_t, len, PAGE_SIZE - offset);
+        page = store->pages[PFN_DOWN(pos)];
+        if(!WARN_ON_ONCE(!page || test_bit(PFN_DOWN(pos), store->shared))){
+            vaddr = kmap_atomic(page);
+            memcpy(vaddr + offset, src, chunk);
+            kunmap_atomic(vaddr);
+        }
+        src += chunk;
+        pos += chunk;
+        len -= chunk;
+    }
+}
+
+void pcd_store_copy(struct pcd_store *dst, size_t dst_pos, struct pcd_store *src, size_t src_pos, size_t len)
+{
+    size_t chunk;
+    char *from, *to;
+
+    while(len){
+        chunk = min3(len, PAGE_SIZE - offset_in_page(dst_pos), PAGE_SIZE - offset_in_page(src_pos));
+        from = kmap_atomic(src->pages[PFN_DOWN(src_pos)]);
+        to = kmap_atomic(dst->pages[PFN_DOWN(dst_pos)]);
+        memcpy(to + offset_in_page(dst_pos), from + offset_in_page(src_pos), chunk);
+        kunmap_atomic(to);
+        kunmap_atomic(from);
+        dst_pos += chunk;
+        src_pos += chunk;
+        len -= chunk;
+    }
+}
+
+//Record an access for the cold page scanner, bits are cleared on every scan
+void pcd_store_touch(struct pcd_store *store, size_t pos, size_t len)
+{
+    unsigned long i;
+
+    if(!len)
+        return;
+    for(i = PFN_DOWN(pos); i <= PFN_DOWN(pos + len - 1); i++)
+        set_bit(i, store->accessed);
+}
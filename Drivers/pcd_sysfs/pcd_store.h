@@ -0,0 +1,41 @@
+#ifndef PCD_STORE_H
+#define PCD_STORE_H
+
+#include <linux/types.h>
+#include <linux/mm_types.h>
+#include <linux/rcupdate.h>
+
+/*Device memory as an array of individually allocated pages, no contiguity needed.
+A store never changes size once published, a resize publishes a new one*/
+struct pcd_store
+{
+    size_t size;
+    unsigned long nr_pages;
+    //Leading pages handed over to the replacing store, not freed on retire
+    unsigned long nr_shared;
+    struct rcu_head rcu;
+    //Pages accessed since the last cold page scan
+    unsigned long *accessed;
+    //Pages shared with other devices or the zero page (holes), copied on their first write
+    unsigned long *shared;
+    //CRC32C of every page when integrity checking is on, NULL otherwise
+    u32 *csum;
+    //NULL slots are pages that are currently compressed
+    struct page *pages[];
+};
+
+struct pcd_store* pcd_store_alloc(size_t size, bool csum);
+void pcd_store_free(struct pcd_store *store);
+struct pcd_store* pcd_store_resize(struct pcd_store *old, size_t new_size);
+void pcd_store_retire(struct pcd_store *old, unsigned long nr_shared);
+void pcd_store_zero_tail(struct pcd_store *store, size_t size);
+void pcd_store_read(struct pcd_store *store, size_t pos, void *dst, size_t len);
+void pcd_store_write(struct pcd_store *store, size_t pos, const void *src, size_t len);
+struct page* pcd_store_copy_page(struct page *page);
+int pcd_store_unshare(struct pcd_store *store);
+u32 pcd_store_csum_buf(const void *buf);
+void pcd_store_csum_page(struct pcd_store *store, unsigned long index);
+void pcd_store_touch(struct pcd_store *store, size_t pos, size_t len);
+void pcd_store_copy(struct pcd_store *dst, size_t dst_pos, struct pcd_store *src, size_t src_pos, size_t len);
+
+#endif
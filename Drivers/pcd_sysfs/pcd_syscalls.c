@@ -1,133 +1,718 @@
 #include "pcd_platform_driver_dt_sysfs.h"
 #include "pcd_syscalls.h"
 
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
+
 loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
-    int max_size = pcdev_data->pdata.size;
-    pr_info("lseek requested\n");
-    pr_info("current file position = %lld\n", filp->f_pos);
-    if (offset > max_size || offset < 0)
-        return -EINVAL;
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    loff_t old_pos = filp->f_pos;
+    loff_t ret;
 
-    switch (whence)
-    {
-    case SEEK_SET:
-        filp->f_pos = offset;
-        break;
-
-    case SEEK_CUR:
-        if (filp->f_pos + offset > max_size || filp->f_pos + offset < 0)
-            return -EINVAL;
-        filp->f_pos += offset;
-        break;
-
-    case SEEK_END:
-        if (max_size + offset > max_size || max_size + offset < 0)
-            return -EINVAL;
-        filp->f_pos = max_size + offset;
-        break;
-
-    default:
-        return -EINVAL;
-    }
+    //SEEK_CUR and SEEK_END take negative offsets as long as the result stays in the device,
+    //SEEK_DATA and SEEK_HOLE look at which pages are holes
+    if (whence == SEEK_DATA || whence == SEEK_HOLE)
+        ret = pcd_cow_seek(pcdev_data, offset, whence);
+    else
+        ret = pcd_seek_pos(filp->f_pos, offset, whence, READ_ONCE(pcdev_data->pdata.size));
+    if (ret >= 0)
+        filp->f_pos = ret;
 
-    pr_info("new value of file position = %lld\n", filp->f_pos);
-    return filp->f_pos;
+    trace_pcd_lseek(pcdev_data->dev_num, old_pos, offset, whence, ret);
+    return ret;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+//Bounce buffers for IOCB_NOWAIT callers must not enter reclaim
+void *pcd_bounce_alloc(size_t len, bool nowait)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
-    int max_size = pcdev_data->pdata.size;
+    if (nowait)
+        return kmalloc(len, GFP_NOWAIT | __GFP_NOWARN);
+    return kvmalloc(len, GFP_KERNEL);
+}
 
-    pr_info("read requested for %zu bytes\n", count);
-    pr_info("Current file position = %lld\n", *f_pos);
+static int pcd_fifo_lock(struct pcdev_private_data *pcdev_data, bool nonblock)
+{
+    u64 start;
+    int ret;
 
-    if ((*f_pos + count) > max_size)
-        count = max_size - *f_pos;
+    if (nonblock)
+        return mutex_trylock(&pcdev_data->pcd_lock) ? 0 : -EAGAIN;
 
-    if (copy_to_user(buff, &pcdev_data->buffer[*f_pos], count))
-        return -EFAULT;
+    start = ktime_get_ns();
+    ret = mutex_lock_interruptible(&pcdev_data->pcd_lock) ? -ERESTARTSYS : 0;
+    pcd_stats_account_lock_wait(pcdev_data, ktime_get_ns() - start);
+    return ret;
+}
 
-    *f_pos += count;
-    pr_info("Number of bytes successfully read = %zu\n", count);
-    pr_info("Updated file position = %lld\n", *f_pos);
+/*FIFO mode: the buffer is a ring of pdata.size bytes holding fifo_len bytes
+starting at fifo_head. Consumers block until data arrives, producers until
+there is room. File position is not used, devices are opened as streams*/
+static ssize_t pcd_fifo_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = min_t(size_t, iov_iter_count(to), READ_ONCE(pcdev_data->pdata.size));
+    size_t len, first, copied;
+    ssize_t ret;
+    char *kbuf;
 
-    // Return the number of bytes successfully read
-    return count;
+    if (!count)
+        return 0;
+
+    kbuf = pcd_bounce_alloc(count, iocb->ki_flags & IOCB_NOWAIT);
+    if (!kbuf)
+        return (iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM;
+
+    /*Readers go one at a time so that the bytes one of them copied out stay at
+    the head of the ring until they reached user space*/
+    if (nonblock){
+        if (!mutex_trylock(&pcdev_data->fifo_read_lock)){
+            ret = -EAGAIN;
+            goto free;
+        }
+    }
+    else if (mutex_lock_interruptible(&pcdev_data->fifo_read_lock)){
+        ret = -ERESTARTSYS;
+        goto free;
+    }
+
+    ret = pcd_fifo_lock(pcdev_data, nonblock);
+    if (ret)
+        goto read_unlock;
+
+    while (!pcdev_data->fifo_len){
+        mutex_unlock(&pcdev_data->pcd_lock);
+        if (nonblock){
+            ret = -EAGAIN;
+            goto read_unlock;
+        }
+        if (wait_event_interruptible(pcdev_data->fifo_wq, READ_ONCE(pcdev_data->fifo_len))){
+            ret = -ERESTARTSYS;
+            goto read_unlock;
+        }
+        ret = pcd_fifo_lock(pcdev_data, false);
+        if (ret)
+            goto read_unlock;
+    }
+
+    len = min_t(size_t, count, pcdev_data->fifo_len);
+    first = min_t(size_t, len, pcdev_data->pdata.size - pcdev_data->fifo_head);
+    pcd_store_read(pcd_locked_store(pcdev_data), pcdev_data->fifo_head, kbuf, first);
+    pcd_store_read(pcd_locked_store(pcdev_data), 0, kbuf + first, len - first);
+    mutex_unlock(&pcdev_data->pcd_lock);
+
+    //The user buffer may be a mapping of this device, its faults take pcd_lock
+    copied = copy_to_iter(kbuf, len, to);
+    if (!copied){
+        ret = -EFAULT;
+        goto read_unlock;
+    }
+
+    /*Only what was copied leaves the ring. Writers only append meanwhile and a
+    resize keeps the head, though a shrink may have dropped part of it*/
+    mutex_lock(&pcdev_data->pcd_lock);
+    len = min_t(size_t, copied, pcdev_data->fifo_len);
+    pcdev_data->fifo_head = (pcdev_data->fifo_head + len) % pcdev_data->pdata.size;
+    pcdev_data->fifo_len -= len;
+    mutex_unlock(&pcdev_data->pcd_lock);
+
+    wake_up_interruptible_poll(&pcdev_data->fifo_wq, EPOLLOUT | EPOLLWRNORM);
+    ret = copied;
+
+read_unlock:
+    mutex_unlock(&pcdev_data->fifo_read_lock);
+free:
+    kvfree(kbuf);
+    return ret;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_fifo_write(struct kiocb *iocb, struct iov_iter *from)
 {
-    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)filp->private_data;
-    int max_size = pcdev_data->pdata.size;
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+    size_t count = min_t(size_t, iov_iter_count(from), READ_ONCE(pcdev_data->pdata.size));
+    size_t len, tail, first;
     ssize_t ret;
+    char *kbuf;
+
+    if (!count)
+        return 0;
+
+    kbuf = pcd_bounce_alloc(count, iocb->ki_flags & IOCB_NOWAIT);
+    if (!kbuf)
+        return (iocb->ki_flags & IOCB_NOWAIT) ? -EAGAIN : -ENOMEM;
+
+    if (!copy_from_iter_full(kbuf, count, from)){
+        ret = -EFAULT;
+        goto free;
+    }
+
+    ret = pcd_fifo_lock(pcdev_data, nonblock);
+    if (ret)
+        goto revert;
+
+    while (pcdev_data->fifo_len == pcdev_data->pdata.size){
+        mutex_unlock(&pcdev_data->pcd_lock);
+        if (nonblock){
+            ret = -EAGAIN;
+            goto revert;
+        }
+        if (wait_event_interruptible(pcdev_data->fifo_wq,
+                READ_ONCE(pcdev_data->fifo_len) < READ_ONCE(pcdev_data->pdata.size))){
+            ret = -ERESTARTSYS;
+            goto revert;
+        }
+        ret = pcd_fifo_lock(pcdev_data, false);
+        if (ret)
+            goto revert;
+    }
+
+    //Append what fits, the caller retries with the remainder like on a pipe
+    len = min_t(size_t, count, pcdev_data->pdata.size - pcdev_data->fifo_len);
+    tail = (pcdev_data->fifo_head + pcdev_data->fifo_len) % pcdev_data->pdata.size;
+    first = min_t(size_t, len, pcdev_data->pdata.size - tail);
+    pcd_store_write(pcd_locked_store(pcdev_data), tail, kbuf, first);
+    pcd_store_write(pcd_locked_store(pcdev_data), 0, kbuf + first, len - first);
+    pcdev_data->fifo_len += len;
+    mutex_unlock(&pcdev_data->pcd_lock);
+
+    wake_up_interruptible_poll(&pcdev_data->fifo_wq, EPOLLIN | EPOLLRDNORM);
+
+    iov_iter_revert(from, count - len);
+    ret = len;
+    goto free;
+
+revert:
+    iov_iter_revert(from, count);
+free:
+    kvfree(kbuf);
+    return ret;
+}
+
+__poll_t pcd_poll(struct file *filp, struct poll_table_struct *wait)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    __poll_t mask = 0;
+
+    //Random access devices can always be read and written
+    if (pcdev_data->pdata.mode == PCD_MODE_RANDOM)
+        return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+    if (pcdev_data->pdata.mode == PCD_MODE_BROADCAST)
+        return pcd_bcast_poll(filp, wait);
+    if (pcdev_data->pdata.mode == PCD_MODE_SHM)
+        return pcd_ring_poll(filp, wait);
+
+    poll_wait(filp, &pcdev_data->fifo_wq, wait);
+
+    if (READ_ONCE(pcdev_data->fifo_len))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    if (READ_ONCE(pcdev_data->fifo_len) < READ_ONCE(pcdev_data->pdata.size))
+        mask |= EPOLLOUT | EPOLLWRNORM;
+
+    return mask;
+}
+
+static int pcd_buf_decompress(struct pcdev_private_data *pcdev_data, size_t pos, size_t len, bool nowait)
+{
+    int ret;
+
+    //Decompression allocates, IOCB_NOWAIT callers are punted to a worker
+    if (nowait)
+        return -EAGAIN;
 
     mutex_lock(&pcdev_data->pcd_lock);
-    pr_info("write requested for %zu bytes\n", count);
-    pr_info("Current file position = %lld\n", *f_pos);
+    ret = pcd_compress_ensure(pcdev_data, pos, len);
+    mutex_unlock(&pcdev_data->pcd_lock);
+    return ret;
+}
+
+/*Snapshot up to count bytes at pos, all in one page of the store, into buf
+without taking pcd_lock. Returns the number of bytes copied*/
+static ssize_t pcd_data_read_page(struct pcdev_private_data *pcdev_data, loff_t pos, void *buf, size_t count,
+    bool nowait)
+{
+    struct pcd_store *store;
+    unsigned int seq;
+    unsigned long bad;
+    size_t len;
+    bool pending, intact;
+    int ret;
+
+    /*Readers never take pcd_lock. Snapshot the page and retry if a writer
+    ran concurrently, so the copy is never torn. A resize publishes a new
+    store, in-flight readers finish on the one they picked up*/
+retry:
+    rcu_read_lock();
+    do {
+        seq = read_seqcount_begin(&pcdev_data->pcd_seq);
+        store = rcu_dereference(pcdev_data->store);
+        len = pcd_clamp_count(pos, count, store->size);
+        pending = pcd_compress_pending(pcdev_data, pos, len);
+        intact = true;
+        if (!pending){
+            pcd_store_read(store, pos, buf, len);
+            intact = pcd_integrity_verify(pcdev_data, store, pos, len, &bad);
+        }
+    } while (read_seqcount_retry(&pcdev_data->pcd_seq, seq));
+    if (!pending)
+        pcd_compress_touch(pcdev_data, store, pos, len);
+    rcu_read_unlock();
 
-    if ((*f_pos + count) > max_size)
-        count = max_size - *f_pos;
+    if (!intact){
+        pcd_integrity_report(pcdev_data, bad);
+        return -EIO;
+    }
+
+    //Compressed pages in range are brought back under pcd_lock, then the snapshot is retried
+    if (pending){
+        ret = pcd_buf_decompress(pcdev_data, pos, len, nowait);
+        if (ret)
+            return ret;
+        goto retry;
+    }
+
+    return len;
+}
 
+/*Copy up to count bytes at pos into buf without taking pcd_lock. Shared by
+read_iter and the block device, returns the number of bytes copied. Each page
+is a snapshot of its own: a writer only ever restarts the copy of one page
+and no RCU read section spans more than that*/
+ssize_t pcd_data_read(struct pcdev_private_data *pcdev_data, loff_t pos, void *buf, size_t count, bool nowait)
+{
+    size_t done = 0, len;
+    ssize_t ret = 0;
+
+    while (done < count){
+        len = min_t(size_t, count - done, PAGE_SIZE - offset_in_page(pos + done));
+        ret = pcd_data_read_page(pcdev_data, pos + done, buf + done, len, nowait);
+        if (ret <= 0)
+            break;
+        done += ret;
+        //Past the end of a store that shrunk meanwhile
+        if ((size_t)ret < len)
+            break;
+    }
+
+    return done ? done : ret;
+}
+
+/*Write up to count bytes from buf at pos under pcd_lock. Returns the number
+of bytes written, -ENOMEM past the end of the device and -EAGAIN for nowait
+callers that would have to sleep*/
+ssize_t pcd_data_write(struct pcdev_private_data *pcdev_data, loff_t pos, const void *buf, size_t count, bool nowait)
+{
+    ssize_t ret;
+
+    //Non-blocking callers (RWF_NOWAIT, io_uring inline issue) get -EAGAIN instead of sleeping
+    if (nowait){
+        if (!mutex_trylock(&pcdev_data->pcd_lock))
+            return -EAGAIN;
+    }
+    else {
+        u64 start = ktime_get_ns();
+        mutex_lock(&pcdev_data->pcd_lock);
+        pcd_stats_account_lock_wait(pcdev_data, ktime_get_ns() - start);
+    }
+
+    //Size may have shrunk since the caller looked at it
+    count = pcd_clamp_count(pos, count, pcd_locked_store(pcdev_data)->size);
     if (!count){
         ret = -ENOMEM;
         goto out;
     }
 
-    if (copy_from_user(&pcdev_data->buffer[*f_pos], buff, count)){
-        ret = -EFAULT;
+    //Bringing pages back or copying shared ones allocates
+    if (nowait && (pcd_compress_pending(pcdev_data, pos, count) ||
+            pcd_cow_pending(pcd_locked_store(pcdev_data), pos, count))){
+        ret = -EAGAIN;
         goto out;
     }
+    ret = pcd_compress_ensure(pcdev_data, pos, count);
+    if (!ret)
+        ret = pcd_cow_break(pcdev_data, pos, count);
+    if (ret)
+        goto out;
 
-    *f_pos += count;
+    write_seqcount_begin(&pcdev_data->pcd_seq);
+    pcd_integrity_write(pcdev_data, pcd_locked_store(pcdev_data), pos, buf, count);
+    write_seqcount_end(&pcdev_data->pcd_seq);
+    pcd_compress_touch(pcdev_data, pcd_locked_store(pcdev_data), pos, count);
+    pcd_backing_mark_dirty(pcdev_data, pos, count);
     ret = count;
-    pr_info("Number of bytes successfully written = %zu\n", count);
-    pr_info("Updated file position = %lld\n", *f_pos);
 
 out:
     mutex_unlock(&pcdev_data->pcd_lock);
+    if (ret > 0)
+        pcd_wake_value_waiters(pcdev_data);
     return ret;
 }
 
-static int check_permission(int dev_perm, int access_mode)
+//Room for one page, large requests are staged through it a page at a time
+static size_t pcd_buf_chunk(loff_t pos, size_t count)
 {
-    if (dev_perm == RDWR)
-        return 0;
+    return min_t(size_t, count, PAGE_SIZE - offset_in_page(pos));
+}
 
-    else if (dev_perm == RDONLY && (access_mode & FMODE_READ) && !(access_mode & FMODE_WRITE))
+static ssize_t pcd_buf_read(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    size_t count = pcd_clamp_count(iocb->ki_pos, iov_iter_count(to), READ_ONCE(pcdev_data->pdata.size));
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    size_t done = 0, copied;
+    ssize_t len = 0;
+    char *kbuf;
+
+    if (!count)
         return 0;
 
-    else if (dev_perm == WRONLY && !(access_mode & FMODE_READ) && (access_mode & FMODE_WRITE))
+    kbuf = pcd_bounce_alloc(min_t(size_t, count, PAGE_SIZE), nowait);
+    if (!kbuf)
+        return nowait ? -EAGAIN : -ENOMEM;
+
+    while (done < count){
+        len = pcd_data_read(pcdev_data, iocb->ki_pos, kbuf, pcd_buf_chunk(iocb->ki_pos, count - done), nowait);
+        if (len <= 0)
+            break;
+
+        copied = copy_to_iter(kbuf, len, to);
+        iocb->ki_pos += copied;
+        done += copied;
+        if (copied < (size_t)len){
+            len = -EFAULT;
+            break;
+        }
+        cond_resched();
+    }
+    kvfree(kbuf);
+
+    // Return the number of bytes successfully read
+    return done ? done : len;
+}
+
+static ssize_t pcd_buf_write(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    size_t count = pcd_clamp_count(iocb->ki_pos, iov_iter_count(from), READ_ONCE(pcdev_data->pdata.size));
+    bool nowait = iocb->ki_flags & IOCB_NOWAIT;
+    size_t done = 0, len, copied;
+    ssize_t ret = 0;
+    char *kbuf;
+
+    //Writes at or past the end fail like on the original fixed size buffer
+    if (!count)
+        return iov_iter_count(from) ? -ENOMEM : 0;
+
+    kbuf = pcd_bounce_alloc(min_t(size_t, count, PAGE_SIZE), nowait);
+    if (!kbuf)
+        return nowait ? -EAGAIN : -ENOMEM;
+
+    /*A page at a time, pcd_lock is never held across more than one. Each chunk
+    is faulted in before taking the lock, the update itself must not sleep*/
+    while (done < count){
+        len = pcd_buf_chunk(iocb->ki_pos, count - done);
+        copied = copy_from_iter(kbuf, len, from);
+        if (copied < len){
+            iov_iter_revert(from, copied);
+            ret = -EFAULT;
+            break;
+        }
+
+        ret = pcd_data_write(pcdev_data, iocb->ki_pos, kbuf, len, nowait);
+        if (ret < 0){
+            iov_iter_revert(from, len);
+            break;
+        }
+
+        //Hand back what did not fit if the device shrunk meanwhile
+        iov_iter_revert(from, len - ret);
+        iocb->ki_pos += ret;
+        done += ret;
+        if ((size_t)ret < len)
+            break;
+        cond_resched();
+    }
+    kvfree(kbuf);
+
+    return done ? done : ret;
+}
+
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    u64 start = ktime_get_ns();
+    u64 latency;
+    size_t count = iov_iter_count(to);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    if (pcdev_data->pdata.mode == PCD_MODE_FIFO)
+        ret = pcd_fifo_read(iocb, to);
+    else if (pcdev_data->pdata.mode == PCD_MODE_BROADCAST)
+        ret = pcd_bcast_read(iocb, to);
+    //Shared memory rings move data through the mapping only
+    else if (pcdev_data->pdata.mode == PCD_MODE_SHM)
+        ret = -EINVAL;
+    else
+        ret = pcd_buf_read(iocb, to);
+
+    latency = ktime_get_ns() - start;
+    pcd_stats_account_read(pcdev_data, count, ret, latency);
+    trace_pcd_read(pcdev_data->dev_num, pos, count, ret, latency);
+    return ret;
+}
+
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(iocb->ki_filp);
+    u64 start = ktime_get_ns();
+    u64 latency;
+    size_t count = iov_iter_count(from);
+    loff_t pos = iocb->ki_pos;
+    ssize_t ret;
+
+    if (pcdev_data->pdata.mode == PCD_MODE_FIFO)
+        ret = pcd_fifo_write(iocb, from);
+    else if (pcdev_data->pdata.mode == PCD_MODE_BROADCAST)
+        ret = pcd_bcast_write(iocb, from);
+    else if (pcdev_data->pdata.mode == PCD_MODE_SHM)
+        ret = -EINVAL;
+    else
+        ret = pcd_buf_write(iocb, from);
+
+    latency = ktime_get_ns() - start;
+    pcd_stats_account_write(pcdev_data, count, ret, latency);
+    trace_pcd_write(pcdev_data->dev_num, pos, count, ret, latency);
+    return ret;
+}
+
+static vm_fault_t pcd_vm_fault(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)vmf->vma->vm_private_data;
+    vm_fault_t ret = VM_FAULT_SIGBUS;
+    struct pcd_store *store;
+    struct page *page;
+    int err;
+
+    /*The page reference taken here keeps the page alive after a resize drops
+    it from the store. Pages past the current size fault with SIGBUS*/
+    rcu_read_lock();
+    store = rcu_dereference(pcdev_data->store);
+    if (vmf->pgoff < store->nr_pages){
+        //A page being compressed is frozen at refcount 0, recheck the slot after pinning it
+        page = READ_ONCE(store->pages[vmf->pgoff]);
+        if (page && get_page_unless_zero(page)){
+            if (READ_ONCE(store->pages[vmf->pgoff]) == page){
+                vmf->page = page;
+                pcd_compress_touch(pcdev_data, store, vmf->pgoff << PAGE_SHIFT, PAGE_SIZE);
+                ret = 0;
+            }
+            else
+                put_page(page);
+        }
+    }
+    rcu_read_unlock();
+
+    if (ret){
+        //Compressed page, decompress it under pcd_lock and map the fresh copy
+        mutex_lock(&pcdev_data->pcd_lock);
+        store = pcd_locked_store(pcdev_data);
+        if (vmf->pgoff < store->nr_pages){
+            err = pcd_compress_ensure(pcdev_data, vmf->pgoff << PAGE_SHIFT, PAGE_SIZE);
+            if (!err){
+                vmf->page = store->pages[vmf->pgoff];
+                get_page(vmf->page);
+                ret = 0;
+            }
+            else
+                ret = vmf_error(err);
+        }
+        mutex_unlock(&pcdev_data->pcd_lock);
+    }
+
+    return ret;
+}
+
+/*First write to a mapped page. Shared pages are mapped read-only, they get
+copied here and the fault is retried so that pcd_vm_fault maps the copy. A
+private page is made writable in place, it is handed back locked since the
+core treats an unlocked page without a ->mapping as truncated and retries*/
+static vm_fault_t pcd_vm_page_mkwrite(struct vm_fault *vmf)
+{
+    struct pcdev_private_data *pcdev_data = (struct pcdev_private_data *)vmf->vma->vm_private_data;
+    struct pcd_store *store;
+    vm_fault_t ret = 0;
+    int err;
+
+    mutex_lock(&pcdev_data->pcd_lock);
+    store = pcd_locked_store(pcdev_data);
+    if (vmf->pgoff >= store->nr_pages || store->pages[vmf->pgoff] != vmf->page){
+        //Copied or resized since it was mapped, the stale pte is gone already
+        ret = VM_FAULT_NOPAGE;
+        goto out;
+    }
+    if (test_bit(vmf->pgoff, store->shared)){
+        err = pcd_cow_break(pcdev_data, vmf->pgoff << PAGE_SHIFT, PAGE_SIZE);
+        ret = err ? vmf_error(err) : VM_FAULT_NOPAGE;
+        goto out;
+    }
+    pcd_backing_mark_dirty(pcdev_data, vmf->pgoff << PAGE_SHIFT, PAGE_SIZE);
+    lock_page(vmf->page);
+    ret = VM_FAULT_LOCKED;
+
+out:
+    mutex_unlock(&pcdev_data->pcd_lock);
+    return ret;
+}
+
+static const struct vm_operations_struct pcd_vm_ops = {
+    .fault = pcd_vm_fault,
+    .page_mkwrite = pcd_vm_page_mkwrite
+};
+
+static int pcd_buf_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    unsigned long limit = PFN_UP(READ_ONCE(pcdev_data->pdata.size));
+
+    //Stores through a mapping bypass the checksums, integrity checked devices only map read-only
+    if (pcdev_data->pdata.integrity){
+        if (vma->vm_flags & VM_WRITE)
+            return -EACCES;
+        vma->vm_flags &= ~VM_MAYWRITE;
+    }
+
+    //Counted in pages and compared against what is left, vm_pgoff + pages can wrap
+    if (vma_pages(vma) > limit || vma->vm_pgoff > limit - vma_pages(vma))
+        return -EINVAL;
+
+    /*Pages are inserted lazily by pcd_vm_fault, which lets a resize zap the
+    mapping and have the next access fault in the new store*/
+    vma->vm_ops = &pcd_vm_ops;
+    vma->vm_private_data = pcdev_data;
+    vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+
+    return 0;
+}
+
+int pcd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct pcdev_private_data *pcdev_data = pcd_file_dev(filp);
+    int ret;
+
+    if (!(vma->vm_flags & VM_SHARED))
+        ret = -EINVAL;
+    else if (pcdev_data->pdata.mode == PCD_MODE_SHM)
+        ret = pcd_ring_mmap(filp, vma);
+    else
+        ret = pcd_buf_mmap(filp, vma);
+
+    trace_pcd_mmap(pcdev_data->dev_num, vma->vm_pgoff << PAGE_SHIFT, vma->vm_end - vma->vm_start,
+        vma->vm_flags & VM_WRITE, ret);
+    return ret;
+}
+
+/*Work deferred from probe to the first open: restoring the backing file and
+giving FIFO and broadcast rings their own pages. Devices nobody opens never
+pay for it*/
+int pcd_prepare(struct pcdev_private_data *pcdev_data)
+{
+    int ret = 0;
+
+    if (smp_load_acquire(&pcdev_data->ready))
         return 0;
 
-    return -EPERM;
+    //resize_lock keeps resizes, write-back and the cold page scan out meanwhile
+    mutex_lock(&pcdev_data->resize_lock);
+    if (pcdev_data->ready)
+        goto out;
+
+    mutex_lock(&pcdev_data->pcd_lock);
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        ret = pcd_store_unshare(pcd_locked_store(pcdev_data));
+    else if (pcdev_data->backing_file)
+        ret = pcd_backing_load(pcdev_data);
+    mutex_unlock(&pcdev_data->pcd_lock);
+
+    if (!ret)
+        smp_store_release(&pcdev_data->ready, true);
+out:
+    mutex_unlock(&pcdev_data->resize_lock);
+    return ret;
+}
+
+/*Device nodes in different places have inodes of their own. All files of a
+device map through the first one's address space, which pcd_unmap_range zaps*/
+static void pcd_share_mapping(struct pcdev_private_data *pcdev_data, struct inode *inode, struct file *filp)
+{
+    mutex_lock(&pcdev_data->pcd_lock);
+    if (!pcdev_data->map_inode){
+        ihold(inode);
+        smp_store_release(&pcdev_data->map_inode, inode);
+    }
+    filp->f_mapping = pcdev_data->map_inode->i_mapping;
+    mutex_unlock(&pcdev_data->pcd_lock);
 }
 
 int pcd_open(struct inode *inode, struct file *filp)
 {
     int ret, minor_n;
     struct pcdev_private_data *pcdev_data;
+    struct pcd_file *pfile;
 
     minor_n = MINOR(inode->i_rdev);
-    pr_info("minor access = %d\n", minor_n);
 
-    // Extract dev private data ptr from its member cdev
-    pcdev_data = container_of(inode->i_cdev, struct pcdev_private_data, cdev);
+    //The file holds a reference on the device until release, remove may run meanwhile
+    pcdev_data = pcd_dev_get(minor_n - MINOR(pcdrv_data.device_num_base));
+    if (!pcdev_data){
+        ret = -ENODEV;
+        goto out;
+    }
 
-    // Save ptr of dev private data for other file operation methods
-    filp->private_data = pcdev_data;
+    ret = pcd_check_permission(READ_ONCE(pcdev_data->pdata.perm), filp->f_mode);
+    if (!ret)
+        ret = pcd_prepare(pcdev_data);
+    if (ret)
+        goto put;
 
-    ret = check_permission(pcdev_data->pdata.perm, filp->f_mode);
+    //Per open state, the other file operation methods find the device through it
+    pfile = kzalloc(sizeof(*pfile), GFP_KERNEL);
+    if (!pfile){
+        ret = -ENOMEM;
+        goto put;
+    }
+    pfile->dev_data = pcdev_data;
+    mutex_init(&pfile->bc_lock);
+    filp->private_data = pfile;
+    pcd_share_mapping(pcdev_data, inode, filp);
 
-    !ret ? pr_info("Open successful\n") : pr_info("Open unsuccessful\n");
+    if (pcdev_data->pdata.mode == PCD_MODE_BROADCAST)
+        pcd_bcast_open(pfile);
+
+    //Ring devices have no file position, lseek and pread/pwrite fail with -ESPIPE
+    if (pcdev_data->pdata.mode != PCD_MODE_RANDOM)
+        stream_open(inode, filp);
+
+    //read_iter/write_iter honour IOCB_NOWAIT, let io_uring issue inline
+    filp->f_mode |= FMODE_NOWAIT;
+    goto out;
+
+put:
+    pcd_dev_put(pcdev_data);
+out:
+    trace_pcd_open(inode->i_rdev, filp->f_mode, ret);
 
     return ret;
 }
 
 int pcd_release(struct inode *inode, struct file *filp)
 {
-	pr_info("release successful\n");
+	struct pcd_file *pfile = filp->private_data;
+
+	//Mappings hold the file, so this runs after the last one is gone
+	pcd_dev_put(pfile->dev_data);
+	kfree(pfile);
+	trace_pcd_release(inode->i_rdev);
 	return 0;
 }
@@ -1,8 +1,69 @@
 #ifndef PCD_SYSCALLS_H
 #define PCD_SYSCALLS_H
+
+/*Boundary rules shared by every entry point. Kept free of device state so
+the same rules apply to read_iter/write_iter, the batch ioctl and the block
+device, and can be checked in isolation*/
+
+//Bytes of a count sized access at pos that fall inside a size byte device
+static inline size_t pcd_clamp_count(loff_t pos, size_t count, size_t size)
+{
+    if (pos < 0 || pos >= size)
+        return 0;
+    return min_t(size_t, count, size - pos);
+}
+
+//New file position for lseek, -EINVAL if it lands outside [0, size]
+static inline loff_t pcd_seek_pos(loff_t cur, loff_t offset, int whence, loff_t size)
+{
+    loff_t base;
+
+    switch (whence)
+    {
+    case SEEK_SET:
+        base = 0;
+        break;
+    case SEEK_CUR:
+        base = cur;
+        break;
+    case SEEK_END:
+        base = size;
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    //Offsets are bounded by size first so base + offset can't overflow
+    if (offset > size || offset < -size || base + offset < 0 || base + offset > size)
+        return -EINVAL;
+    return base + offset;
+}
+
+//Whether an open with access_mode is allowed on a device with dev_perm, the char and block device share it
+static inline int pcd_check_permission(int dev_perm, fmode_t access_mode)
+{
+    if (dev_perm == RDWR)
+        return 0;
+
+    else if (dev_perm == RDONLY && (access_mode & FMODE_READ) && !(access_mode & FMODE_WRITE))
+        return 0;
+
+    else if (dev_perm == WRONLY && !(access_mode & FMODE_READ) && (access_mode & FMODE_WRITE))
+        return 0;
+
+    return -EPERM;
+}
+
+void *pcd_bounce_alloc(size_t len, bool nowait);
 loff_t pcd_lseek(struct file *filp, loff_t offset, int whence);
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos);
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos);
+ssize_t pcd_read_iter(struct kiocb *iocb, struct iov_iter *to);
+ssize_t pcd_write_iter(struct kiocb *iocb, struct iov_iter *from);
+int pcd_prepare(struct pcdev_private_data *pcdev_data);
 int pcd_open(struct inode *inode, struct file *filp);
 int pcd_release(struct inode *inode, struct file *filp);
+__poll_t pcd_poll(struct file *filp, struct poll_table_struct *wait);
+int pcd_mmap(struct file *filp, struct vm_area_struct *vma);
+ssize_t pcd_data_read(struct pcdev_private_data *pcdev_data, loff_t pos, void *buf, size_t count, bool nowait);
+ssize_t pcd_data_write(struct pcdev_private_data *pcdev_data, loff_t pos, const void *buf, size_t count, bool nowait);
+long pcd_ioctl(struct file *filp, unsigned int cmd, unsigned long arg);
 #endif
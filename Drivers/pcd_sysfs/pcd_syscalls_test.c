@@ -0,0 +1,309 @@
+#include <kunit/test.h>
+#include <linux/math64.h>
+#include "pcd_platform_driver_dt_sysfs.h"
+#include "pcd_syscalls.h"
+
+/*Boundary rules of pcd_syscalls.h. They are pure functions of their
+arguments, no device is needed*/
+
+#define PCD_TEST_SIZE 512
+
+static void pcd_clamp_count_test(struct kunit *test)
+{
+    //Inside the device
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(0, 100, PCD_TEST_SIZE), (size_t)100);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(500, 100, PCD_TEST_SIZE), (size_t)12);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(0, SIZE_MAX, PCD_TEST_SIZE), (size_t)PCD_TEST_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(PCD_TEST_SIZE - 1, 1, PCD_TEST_SIZE), (size_t)1);
+
+    //Exactly at the end and past it
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(PCD_TEST_SIZE, 1, PCD_TEST_SIZE), (size_t)0);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(PCD_TEST_SIZE + 1, 1, PCD_TEST_SIZE), (size_t)0);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(LLONG_MAX, 1, PCD_TEST_SIZE), (size_t)0);
+
+    //Negative positions
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(-1, 1, PCD_TEST_SIZE), (size_t)0);
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(LLONG_MIN, SIZE_MAX, PCD_TEST_SIZE), (size_t)0);
+
+    //Empty device
+    KUNIT_EXPECT_EQ(test, pcd_clamp_count(0, 1, 0), (size_t)0);
+}
+
+static void pcd_seek_pos_set_test(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, 0, SEEK_SET, PCD_TEST_SIZE), 0LL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 42, SEEK_SET, PCD_TEST_SIZE), 42LL);
+    //The end itself is a valid position, one past it is not
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, PCD_TEST_SIZE, SEEK_SET, PCD_TEST_SIZE), (loff_t)PCD_TEST_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, PCD_TEST_SIZE + 1, SEEK_SET, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, -1, SEEK_SET, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, LLONG_MAX, SEEK_SET, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, LLONG_MIN, SEEK_SET, PCD_TEST_SIZE), (loff_t)-EINVAL);
+}
+
+static void pcd_seek_pos_cur_test(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, 0, SEEK_CUR, PCD_TEST_SIZE), 100LL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, -100, SEEK_CUR, PCD_TEST_SIZE), 0LL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, -101, SEEK_CUR, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, PCD_TEST_SIZE - 100, SEEK_CUR, PCD_TEST_SIZE), (loff_t)PCD_TEST_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(100, PCD_TEST_SIZE - 99, SEEK_CUR, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    //Huge offsets are rejected before they are added to the position
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(PCD_TEST_SIZE, LLONG_MAX, SEEK_CUR, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, LLONG_MIN, SEEK_CUR, PCD_TEST_SIZE), (loff_t)-EINVAL);
+}
+
+static void pcd_seek_pos_end_test(struct kunit *test)
+{
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 0, SEEK_END, PCD_TEST_SIZE), (loff_t)PCD_TEST_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, -PCD_TEST_SIZE, SEEK_END, PCD_TEST_SIZE), 0LL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 1, SEEK_END, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, -PCD_TEST_SIZE - 1, SEEK_END, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, LLONG_MAX, SEEK_END, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, LLONG_MIN, SEEK_END, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    //An empty device only has position 0
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 0, SEEK_END, 0), 0LL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, -1, SEEK_END, 0), (loff_t)-EINVAL);
+}
+
+static void pcd_seek_pos_whence_test(struct kunit *test)
+{
+    //SEEK_DATA and SEEK_HOLE are handled by pcd_cow_seek, never by this helper
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 0, SEEK_DATA, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 0, SEEK_HOLE, PCD_TEST_SIZE), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, pcd_seek_pos(0, 0, -1, PCD_TEST_SIZE), (loff_t)-EINVAL);
+}
+
+/*Device backed cases. The device is built the way probe builds it, minus
+the parts that need a platform device: no device file, no block device and
+no backing file. Holes read from pcdrv_data.zero_page, which module init
+set up before any suite runs*/
+
+//Bytes of 3 pages and a partial one, reads and writes straddle page boundaries
+#define PCD_TEST_DEV_SIZE (3 * PAGE_SIZE + 5)
+#define PCD_BENCH_ITERS 10000
+
+static struct pcdev_private_data* pcd_test_dev_alloc(size_t size)
+{
+    struct pcdev_private_data *dev_data;
+    struct pcd_store *store;
+
+    dev_data = kzalloc(sizeof(*dev_data), GFP_KERNEL);
+    if (!dev_data)
+        return NULL;
+
+    kref_init(&dev_data->ref);
+    mutex_init(&dev_data->pcd_lock);
+    mutex_init(&dev_data->resize_lock);
+    mutex_init(&dev_data->fifo_read_lock);
+    seqcount_mutex_init(&dev_data->pcd_seq, &dev_data->pcd_lock);
+    init_waitqueue_head(&dev_data->fifo_wq);
+    init_waitqueue_head(&dev_data->value_wq);
+    pcd_compress_init(dev_data);
+    pcd_integrity_init(dev_data);
+
+    dev_data->pdata.size = size;
+    dev_data->pdata.perm = RDWR;
+    dev_data->pdata.mode = PCD_MODE_RANDOM;
+    dev_data->ready = true;
+
+    //pcd_dev_put releases whatever got allocated
+    store = pcd_store_alloc(size, false);
+    RCU_INIT_POINTER(dev_data->store, store);
+    dev_data->stats = pcd_stats_alloc();
+    if (!store || !dev_data->stats){
+        pcd_dev_put(dev_data);
+        return NULL;
+    }
+    return dev_data;
+}
+
+static int pcd_data_test_init(struct kunit *test)
+{
+    test->priv = pcd_test_dev_alloc(PCD_TEST_DEV_SIZE);
+    return test->priv ? 0 : -ENOMEM;
+}
+
+static void pcd_data_test_exit(struct kunit *test)
+{
+    pcd_dev_put(test->priv);
+}
+
+static void pcd_test_fill(u8 *buf, size_t len, u8 seed)
+{
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        buf[i] = seed + i * 7;
+}
+
+//Write and read back whole devices of sizes around the page size
+static void pcd_data_rw_sizes_test(struct kunit *test)
+{
+    static const size_t sizes[] = { 1, 100, PAGE_SIZE - 1, PAGE_SIZE, PAGE_SIZE + 1, 3 * PAGE_SIZE + 5 };
+    struct pcdev_private_data *dev_data;
+    u8 *in, *out;
+    size_t size;
+    unsigned int i;
+
+    for (i = 0; i < ARRAY_SIZE(sizes); i++){
+        size = sizes[i];
+        in = kunit_kzalloc(test, size + 1, GFP_KERNEL);
+        out = kunit_kzalloc(test, size + 1, GFP_KERNEL);
+        KUNIT_ASSERT_NOT_NULL(test, in);
+        KUNIT_ASSERT_NOT_NULL(test, out);
+        dev_data = pcd_test_dev_alloc(size);
+        KUNIT_ASSERT_NOT_NULL(test, dev_data);
+
+        //Nothing written yet, all of it reads back as zeros
+        memset(out, 0xff, size);
+        KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, 0, out, size, false), (ssize_t)size);
+        KUNIT_EXPECT_TRUE(test, !memchr_inv(out, 0, size));
+
+        pcd_test_fill(in, size, i);
+        KUNIT_EXPECT_EQ(test, pcd_data_write(dev_data, 0, in, size, false), (ssize_t)size);
+        KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, 0, out, size, false), (ssize_t)size);
+        KUNIT_EXPECT_EQ(test, memcmp(in, out, size), 0);
+
+        //Accesses running past the end are cut short, at the end there is nothing left
+        KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, size - 1, out, 2, false), (ssize_t)1);
+        KUNIT_EXPECT_EQ(test, out[0], in[size - 1]);
+        KUNIT_EXPECT_EQ(test, pcd_data_write(dev_data, size - 1, in, 2, false), (ssize_t)1);
+        KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, size, out, 1, false), (ssize_t)0);
+        KUNIT_EXPECT_EQ(test, pcd_data_write(dev_data, size, in, 1, false), (ssize_t)-ENOMEM);
+
+        pcd_dev_put(dev_data);
+    }
+}
+
+//Partial writes inside a page leave the rest of it alone
+static void pcd_data_rw_offset_test(struct kunit *test)
+{
+    struct pcdev_private_data *dev_data = test->priv;
+    u8 *in = kunit_kzalloc(test, PCD_TEST_DEV_SIZE, GFP_KERNEL);
+    u8 *out = kunit_kzalloc(test, PCD_TEST_DEV_SIZE, GFP_KERNEL);
+    loff_t pos = PAGE_SIZE - 3;
+
+    KUNIT_ASSERT_NOT_NULL(test, in);
+    KUNIT_ASSERT_NOT_NULL(test, out);
+
+    //Straddles the first page boundary
+    pcd_test_fill(in, 8, 1);
+    KUNIT_EXPECT_EQ(test, pcd_data_write(dev_data, pos, in, 8, false), (ssize_t)8);
+    KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, 0, out, PCD_TEST_DEV_SIZE, false), (ssize_t)PCD_TEST_DEV_SIZE);
+    KUNIT_EXPECT_TRUE(test, !memchr_inv(out, 0, pos));
+    KUNIT_EXPECT_EQ(test, memcmp(out + pos, in, 8), 0);
+    KUNIT_EXPECT_TRUE(test, !memchr_inv(out + pos + 8, 0, PCD_TEST_DEV_SIZE - pos - 8));
+
+    //Negative positions are outside the device
+    KUNIT_EXPECT_EQ(test, pcd_data_read(dev_data, -1, out, 1, false), (ssize_t)0);
+    KUNIT_EXPECT_EQ(test, pcd_data_write(dev_data, -1, in, 1, false), (ssize_t)-ENOMEM);
+}
+
+static void pcd_lseek_test(struct kunit *test)
+{
+    struct pcdev_private_data *dev_data = test->priv;
+    struct pcd_file *pfile = kunit_kzalloc(test, sizeof(*pfile), GFP_KERNEL);
+    struct file *filp = kunit_kzalloc(test, sizeof(*filp), GFP_KERNEL);
+    u8 byte = 0x5a;
+
+    KUNIT_ASSERT_NOT_NULL(test, pfile);
+    KUNIT_ASSERT_NOT_NULL(test, filp);
+    pfile->dev_data = dev_data;
+    filp->private_data = pfile;
+
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, -1, SEEK_END), (loff_t)PCD_TEST_DEV_SIZE - 1);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, -10, SEEK_CUR), (loff_t)PCD_TEST_DEV_SIZE - 11);
+    //A failed seek leaves the position where it was
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, 1, SEEK_END), (loff_t)-EINVAL);
+    KUNIT_EXPECT_EQ(test, filp->f_pos, (loff_t)PCD_TEST_DEV_SIZE - 11);
+
+    //A fresh device is one hole, which ends at the end of the device
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, 0, SEEK_DATA), (loff_t)-ENXIO);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, 10, SEEK_HOLE), 10LL);
+
+    //Writing a byte turns its page into data
+    KUNIT_ASSERT_EQ(test, pcd_data_write(dev_data, PAGE_SIZE + 1, &byte, 1, false), (ssize_t)1);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, 0, SEEK_DATA), (loff_t)PAGE_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, PAGE_SIZE + 2, SEEK_DATA), (loff_t)PAGE_SIZE + 2);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, PAGE_SIZE, SEEK_HOLE), (loff_t)2 * PAGE_SIZE);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, 2 * PAGE_SIZE, SEEK_DATA), (loff_t)-ENXIO);
+    KUNIT_EXPECT_EQ(test, pcd_lseek(filp, PCD_TEST_DEV_SIZE, SEEK_HOLE), (loff_t)-ENXIO);
+}
+
+/*Microbenchmarks, they only report ns/op in the log and never fail. Writes
+are timed after the first one made the pages private, so they measure the
+steady state and not the copy of the zero page*/
+static void pcd_bench_report(struct kunit *test, const char *name, u64 ns)
+{
+    kunit_info(test, "%s: %llu ns/op over %d ops\n", name, div_u64(ns, PCD_BENCH_ITERS), PCD_BENCH_ITERS);
+}
+
+static void pcd_data_bench(struct kunit *test, size_t len)
+{
+    struct pcdev_private_data *dev_data = test->priv;
+    u8 *buf = kunit_kzalloc(test, len, GFP_KERNEL);
+    char name[32];
+    u64 start;
+    int i;
+
+    KUNIT_ASSERT_NOT_NULL(test, buf);
+    KUNIT_ASSERT_EQ(test, pcd_data_write(dev_data, 0, buf, len, false), (ssize_t)len);
+
+    start = ktime_get_ns();
+    for (i = 0; i < PCD_BENCH_ITERS; i++)
+        pcd_data_read(dev_data, 0, buf, len, false);
+    snprintf(name, sizeof(name), "read %zu", len);
+    pcd_bench_report(test, name, ktime_get_ns() - start);
+
+    start = ktime_get_ns();
+    for (i = 0; i < PCD_BENCH_ITERS; i++)
+        pcd_data_write(dev_data, 0, buf, len, false);
+    snprintf(name, sizeof(name), "write %zu", len);
+    pcd_bench_report(test, name, ktime_get_ns() - start);
+}
+
+//Page sized transfers, dominated by the copy
+static void pcd_data_bench_page(struct kunit *test)
+{
+    pcd_data_bench(test, PAGE_SIZE);
+}
+
+//Word sized transfers, dominated by the seqcount snapshot on reads and pcd_lock on writes
+static void pcd_data_bench_word(struct kunit *test)
+{
+    pcd_data_bench(test, sizeof(u64));
+}
+
+static struct kunit_case pcd_syscalls_test_cases[] = {
+    KUNIT_CASE(pcd_clamp_count_test),
+    KUNIT_CASE(pcd_seek_pos_set_test),
+    KUNIT_CASE(pcd_seek_pos_cur_test),
+    KUNIT_CASE(pcd_seek_pos_end_test),
+    KUNIT_CASE(pcd_seek_pos_whence_test),
+    {}
+};
+
+static struct kunit_suite pcd_syscalls_test_suite = {
+    .name = "pcd_syscalls",
+    .test_cases = pcd_syscalls_test_cases
+};
+
+static struct kunit_case pcd_data_test_cases[] = {
+    KUNIT_CASE(pcd_data_rw_sizes_test),
+    KUNIT_CASE(pcd_data_rw_offset_test),
+    KUNIT_CASE(pcd_lseek_test),
+    KUNIT_CASE(pcd_data_bench_page),
+    KUNIT_CASE(pcd_data_bench_word),
+    {}
+};
+
+static struct kunit_suite pcd_data_test_suite = {
+    .name = "pcd_data",
+    .init = pcd_data_test_init,
+    .exit = pcd_data_test_exit,
+    .test_cases = pcd_data_test_cases
+};
+
+//Linked into pcd_sysfs.ko, the suites run once its module init is done
+kunit_test_suites(&pcd_syscalls_test_suite, &pcd_data_test_suite);
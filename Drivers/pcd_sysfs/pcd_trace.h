@@ -0,0 +1,102 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pcd
+
+#if !defined(PCD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PCD_TRACE_H
+
+//Layouts are shared with the other pcd modules, mmap and probe are pcd_sysfs only
+#include "pcd_trace_events.h"
+
+DEFINE_EVENT(pcd_io_class, pcd_read,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_io_class, pcd_write,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_lseek_class, pcd_lseek,
+    TP_PROTO(dev_t dev, loff_t old_pos, loff_t offset, int whence, loff_t ret),
+    TP_ARGS(dev, old_pos, offset, whence, ret)
+);
+
+TRACE_EVENT(pcd_mmap,
+
+    TP_PROTO(dev_t dev, unsigned long offset, unsigned long len, bool write, int ret),
+
+    TP_ARGS(dev, offset, len, write, ret),
+
+    TP_STRUCT__entry(
+        __field(dev_t, dev)
+        __field(unsigned long, offset)
+        __field(unsigned long, len)
+        __field(bool, write)
+        __field(int, ret)
+    ),
+
+    TP_fast_assign(
+        __entry->dev = dev;
+        __entry->offset = offset;
+        __entry->len = len;
+        __entry->write = write;
+        __entry->ret = ret;
+    ),
+
+    TP_printk("dev=%d:%d offset=%lu len=%lu write=%d ret=%d",
+        MAJOR(__entry->dev), MINOR(__entry->dev), __entry->offset, __entry->len,
+        __entry->write, __entry->ret)
+);
+
+DEFINE_EVENT(pcd_open_class, pcd_open,
+    TP_PROTO(dev_t dev, fmode_t mode, int ret),
+    TP_ARGS(dev, mode, ret)
+);
+
+DEFINE_EVENT(pcd_release_class, pcd_release,
+    TP_PROTO(dev_t dev),
+    TP_ARGS(dev)
+);
+
+TRACE_EVENT(pcd_probe,
+
+    TP_PROTO(const char *name, int size, int perm, int mode, int ret, u64 latency_ns),
+
+    TP_ARGS(name, size, perm, mode, ret, latency_ns),
+
+    TP_STRUCT__entry(
+        __string(name, name)
+        __field(int, size)
+        __field(int, perm)
+        __field(int, mode)
+        __field(int, ret)
+        __field(u64, latency_ns)
+    ),
+
+    TP_fast_assign(
+        __assign_str(name, name);
+        __entry->size = size;
+        __entry->perm = perm;
+        __entry->mode = mode;
+        __entry->ret = ret;
+        __entry->latency_ns = latency_ns;
+    ),
+
+    TP_printk("name=%s size=%d perm=0x%x mode=%d ret=%d latency_ns=%llu",
+        __get_str(name), __entry->size, __entry->perm, __entry->mode,
+        __entry->ret, __entry->latency_ns)
+);
+
+DEFINE_EVENT(pcd_remove_class, pcd_remove,
+    TP_PROTO(dev_t dev, const char *serial),
+    TP_ARGS(dev, serial)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcd_trace
+#include <trace/define_trace.h>
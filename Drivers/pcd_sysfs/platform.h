@@ -5,13 +5,23 @@
 #define RDONLY 0x01
 #define WRONLY 0x10
 
-#define MAX_DEVICES 10
+//Default for the max_devices module parameter, one minor per device
+#define MAX_DEVICES 1024
+
+#define PCD_MODE_RANDOM 0
+#define PCD_MODE_FIFO 1
+#define PCD_MODE_BROADCAST 2
+#define PCD_MODE_SHM 3
 
 struct pcdev_platform_data
 {
     int size;
     int perm;
     const char* serial_number;
+    int mode;
+    const char* backing_file;
+    unsigned int compress_interval_ms;
+    bool integrity;
 };
 
 #endif
\ No newline at end of file
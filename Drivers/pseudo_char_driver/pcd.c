@@ -4,8 +4,14 @@
 #include <linux/device.h>
 #include <linux/kdev_t.h>
 #include <linux/uaccess.h>
+#include <linux/ktime.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+
+#define CREATE_TRACE_POINTS
+#include "pcd_trace.h"
 
 #define DEV_MEM_SIZE 512
 
@@ -21,11 +27,11 @@ struct cdev pcd_cdev;
 
 //static DEFINE_SPINLOCK(pcd_spinlock);
 static DEFINE_MUTEX(pcd_mutexlock);
+//Readers retry on this sequence count instead of serializing behind writers
+static seqcount_mutex_t pcd_seqcount = SEQCNT_MUTEX_ZERO(pcd_seqcount, &pcd_mutexlock);
 
-loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+static loff_t pcd_do_lseek(struct file *filp, loff_t offset, int whence)
 {
-	pr_info("lseek requested\n");
-	pr_info("current file position = %lld\n",filp->f_pos);
 	if(offset > DEV_MEM_SIZE || offset < 0)
 		return -EINVAL;
 	
@@ -51,82 +57,118 @@ loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
 		return -EINVAL;
 	}
 
-	pr_info("new value of file position = %lld\n",filp->f_pos);
 	return filp->f_pos;
 }
 
-ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
 {
-    //spin_lock(&pcd_spinlock); //Not suitable since critical section may sleep
-    //mutex_lock(&pcd_mutexlock);
+    unsigned int seq;
+    char *kbuf;
 
-    /*Returns 0 on acquiring lock or error code -EINTR on interrupt
-    Better option over simple mutex which may never return on process termination*/
-    if(mutex_lock_interruptible(&pcd_mutexlock))
-        return -EINTR;
+	if(*f_pos >= DEV_MEM_SIZE)
+		return 0;
 
-	pr_info("read requested for %zu bytes\n", count);
-	pr_info("Current file position = %lld\n", *f_pos);
-	
 	if((*f_pos + count) > DEV_MEM_SIZE)
 		count = DEV_MEM_SIZE - *f_pos;
+
+    kbuf = kmalloc(count, GFP_KERNEL);
+    if(!kbuf)
+        return -ENOMEM;
+
+    /*Readers don't take pcd_mutexlock, so any number of them run in parallel.
+    Copy into a bounce buffer and retry if a writer ran meanwhile to avoid tearing*/
+    do {
+        seq = read_seqcount_begin(&pcd_seqcount);
+        memcpy(kbuf, &device_buffer[*f_pos], count);
+    } while(read_seqcount_retry(&pcd_seqcount, seq));
 	
-	if(copy_to_user(buff, &device_buffer[*f_pos], count))
+	if(copy_to_user(buff, kbuf, count)){
+        kfree(kbuf);
 		return -EFAULT; 
+    }
+    kfree(kbuf);
 
 	*f_pos += count;
-	pr_info("Number of bytes successfully read = %zu\n", count);
-	pr_info("Updated file position = %lld\n", *f_pos);
-    
-    //spin_unlock(&pcd_spinlock);
-    mutex_unlock(&pcd_mutexlock);
 
 	//Return the number of bytes successfully read
 	return count;
 }
 
-ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+static ssize_t pcd_do_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
 {
-    //spin_lock(&pcd_spinlock); //Not suitable since critical section may sleep
-    //mutex_lock(&pcd_mutexlock);
+    char *kbuf;
 
-    /*Returns 0 on acquiring lock or error code -EINTR on interrupt
-    Better option over simple mutex which may never return on process termination*/
-    if(mutex_lock_interruptible(&pcd_mutexlock))
-        return -EINTR;
+	if(*f_pos >= DEV_MEM_SIZE)
+		return -ENOMEM;
 
-	pr_info("write requested for %zu bytes\n", count);
-	pr_info("Current file position = %lld\n", *f_pos);
-	
 	if((*f_pos + count) > DEV_MEM_SIZE)
 		count = DEV_MEM_SIZE - *f_pos;
 	
-	if(!count)
-		return -ENOMEM;
-	
-	if(copy_from_user(&device_buffer[*f_pos], buff, count))
-		return -EFAULT; 
+    //Fault user data in before taking the lock, the sequence count section must not sleep
+    kbuf = memdup_user(buff, count);
+    if(IS_ERR(kbuf))
+        return PTR_ERR(kbuf);
 
-	*f_pos += count;
-	pr_info("Number of bytes successfully written = %zu\n", count);
-	pr_info("Updated file position = %lld\n", *f_pos);
+    /*Returns 0 on acquiring lock or error code -EINTR on interrupt
+    Better option over simple mutex which may never return on process termination*/
+    if(mutex_lock_interruptible(&pcd_mutexlock)){
+        kfree(kbuf);
+        return -EINTR;
+    }
+
+    write_seqcount_begin(&pcd_seqcount);
+    memcpy(&device_buffer[*f_pos], kbuf, count);
+    write_seqcount_end(&pcd_seqcount);
 
-    //spin_unlock(&pcd_spinlock);
     mutex_unlock(&pcd_mutexlock);
+    kfree(kbuf);
+
+	*f_pos += count;
 
 	//Return the number of bytes successfully written
 	return count;
 }
 
+//Traced here so that every return path of the file operations is covered
+loff_t pcd_lseek(struct file *filp, loff_t offset, int whence)
+{
+	loff_t old_pos = filp->f_pos;
+	loff_t ret = pcd_do_lseek(filp, offset, whence);
+
+	trace_pcd_single_lseek(file_inode(filp)->i_rdev, old_pos, offset, whence, ret);
+	return ret;
+}
+
+ssize_t pcd_read(struct file *filp, char __user *buff, size_t count, loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	//Only timed while the event is enabled, latency is 0 otherwise
+	u64 start = trace_pcd_single_read_enabled() ? ktime_get_ns() : 0;
+	ssize_t ret = pcd_do_read(filp, buff, count, f_pos);
+
+	trace_pcd_single_read(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
+	return ret;
+}
+
+ssize_t pcd_write(struct file *filp, const char __user *buff, size_t count, loff_t *f_pos)
+{
+	loff_t pos = *f_pos;
+	u64 start = trace_pcd_single_write_enabled() ? ktime_get_ns() : 0;
+	ssize_t ret = pcd_do_write(filp, buff, count, f_pos);
+
+	trace_pcd_single_write(file_inode(filp)->i_rdev, pos, count, ret, start ? ktime_get_ns() - start : 0);
+	return ret;
+}
+
 int pcd_open(struct inode *inode, struct file *filp)
 {
-	pr_info("open successful\n");
+	trace_pcd_single_open(inode->i_rdev, filp->f_mode, 0);
 	return 0;
 }
 
 int pcd_release(struct inode *inode, struct file *filp)
 {
-	pr_info("release successful\n");
+	trace_pcd_single_release(inode->i_rdev);
 	return 0;
 }
 
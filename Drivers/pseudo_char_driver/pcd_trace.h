@@ -0,0 +1,41 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM pcd_single
+
+#if !defined(PCD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define PCD_TRACE_H
+
+//Layouts are shared with the other pcd modules, the event names are this module's
+#include "pcd_trace_events.h"
+
+DEFINE_EVENT(pcd_io_class, pcd_single_read,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_io_class, pcd_single_write,
+    TP_PROTO(dev_t dev, loff_t pos, size_t count, ssize_t ret, u64 latency_ns),
+    TP_ARGS(dev, pos, count, ret, latency_ns)
+);
+
+DEFINE_EVENT(pcd_lseek_class, pcd_single_lseek,
+    TP_PROTO(dev_t dev, loff_t old_pos, loff_t offset, int whence, loff_t ret),
+    TP_ARGS(dev, old_pos, offset, whence, ret)
+);
+
+DEFINE_EVENT(pcd_open_class, pcd_single_open,
+    TP_PROTO(dev_t dev, fmode_t mode, int ret),
+    TP_ARGS(dev, mode, ret)
+);
+
+DEFINE_EVENT(pcd_release_class, pcd_single_release,
+    TP_PROTO(dev_t dev),
+    TP_ARGS(dev)
+);
+
+#endif
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE pcd_trace
+#include <trace/define_trace.h>